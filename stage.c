@@ -23,16 +23,21 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/mman.h>
 #include <sys/wait.h>
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
 
+#include <drm_fourcc.h>
 #include <linux/input-event-codes.h>
 #include <wlr/backend.h>
 #include <wlr/backend/libinput.h>
+#include <wlr/interfaces/wlr_buffer.h>
 #include <wlr/interfaces/wlr_keyboard.h>
 #include <wlr/render/allocator.h>
 #include <wlr/render/wlr_renderer.h>
@@ -58,6 +63,7 @@
 #include <wlr/types/wlr_seat.h>
 #include <wlr/types/wlr_server_decoration.h>
 #include <wlr/types/wlr_session_lock_v1.h>
+#include <wlr/types/wlr_single_pixel_buffer_v1.h>
 #include <wlr/types/wlr_subcompositor.h>
 #include <wlr/types/wlr_viewporter.h>
 #include <wlr/types/wlr_virtual_keyboard_v1.h>
@@ -67,6 +73,7 @@
 #include <wlr/types/wlr_xdg_output_v1.h>
 #include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/types/wlr_text_input_v3.h>
+#include <wlr/util/box.h>
 #include <wlr/util/log.h>
 #include <xkbcommon/xkbcommon.h>
 
@@ -76,12 +83,33 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "ext-workspace-v1-protocol.h"
+#include "state.h"
+
 #define dprintf(args...)
 
+#define	N_SLOTS		5
+#define	N_WORKSPACES	16
+
 static const float color_focused[] = { 0.8, 0.4, 0.1, 0.1 };
 static const float color_default[] = { 0.4, 0.4, 0.4, 0.1 };
+static const float color_lock[] = { 0.0, 0.0, 0.0, 1.0 };
 
-#define	SERVER_SOCK_FILE	"/tmp/stage.sock"
+/*
+ * Frame callback caps by app_id, in Hz.  0 is no cap; an unfocused
+ * rate of 0 is the same as the focused one.  None by default: while no
+ * view has a rule, frames go out the plain wlroots way.
+ */
+static const struct stage_rate_rule {
+	const char *app_id;
+	int rate;
+	int unfocused_rate;
+} rate_rules[] = {
+#if 0
+	{ "foot", 0, 30 },	/* Unfocused terminals at 30 Hz. */
+#endif
+	{ NULL, 0, 0 },
+};
 
 enum stage_cursor_mode {
 	STAGE_CURSOR_PASSTHROUGH,
@@ -90,12 +118,24 @@ enum stage_cursor_mode {
 	STAGE_CURSOR_SCROLL,		/* left mouse button + move */
 };
 
+/* Scene layers, bottom to top. */
+enum stage_layer {
+	STAGE_LAYER_BACKGROUND,
+	STAGE_LAYER_BOTTOM,
+	STAGE_LAYER_TOPLEVEL,
+	STAGE_LAYER_TOP,
+	STAGE_LAYER_OVERLAY,
+	STAGE_LAYER_LOCK,
+	STAGE_NLAYERS,
+};
+
 struct stage_server {
 	struct wl_display *wl_disp;
 	struct wlr_backend *backend;
 	struct wlr_renderer *renderer;
 	struct wlr_allocator *allocator;
 	struct wlr_scene *scene;
+	struct wlr_scene_tree *layer_trees[STAGE_NLAYERS];
 	struct wlr_presentation *presentation;
 	struct wl_listener new_output;
 	struct wl_listener new_xdg_surface;
@@ -157,6 +197,24 @@ struct stage_server {
 
 	struct wlr_xdg_decoration_manager_v1 *xdg_decoration_manager;
 	struct wl_listener xdg_decoration;
+
+	struct stage_state *state;
+	int state_fd;
+	bool cursor_moved;		/* Cursor slot is stale. */
+	int state_sock;
+	struct wl_event_source *state_source;
+
+	struct wl_global *ext_ws_global;
+	struct wl_list ext_ws_clients;
+
+	bool indicator;			/* Built-in workspace indicator. */
+
+	int occluded_rate;		/* Hz, 0: no frames when occluded. */
+	struct wl_event_source *occluded_source;
+	bool occluded_armed;
+
+	int nrated;			/* Views with a rate rule. */
+	uint32_t frame_seq;
 };
 
 struct stage_output {
@@ -166,7 +224,18 @@ struct stage_output {
 	struct wl_listener frame;
 	struct wl_listener request_state;
 	struct wl_listener destroy;
+	struct wl_listener bind;
+	struct wl_event_source *frame_timer;	/* Wakes held views. */
 	int curws;
+	struct wl_list layers;		/* stage_layer_surface::link */
+	struct wlr_box usable_area;	/* Minus exclusive zones. */
+	struct wlr_scene_tree *layer_trees[STAGE_NLAYERS];
+	struct wlr_scene_rect *lock_rect;	/* Under the lock surface. */
+	struct wlr_session_lock_surface_v1 *lock_surface;
+	struct wlr_scene_surface *lock_scene;
+	struct wlr_scene_tree *indicator;
+	struct wlr_scene_buffer *ind_cells[N_WORKSPACES];
+	int ind_state[N_WORKSPACES];
 };
 
 enum stage_view_type {
@@ -188,6 +257,9 @@ struct stage_view {
 	struct wl_listener request_resize;
 	struct wl_listener set_app_id;
 	struct wl_listener commit;
+	struct wlr_xdg_toplevel_decoration_v1 *decoration;
+	struct wl_listener decoration_request_mode;
+	struct wl_listener decoration_destroy;
 	int x, y, w, h;
 	int sx, sy, sw, sh;	/* saved */
 	int maxverted;
@@ -196,14 +268,39 @@ struct stage_view {
 	struct wlr_scene_rect *bg_rect; /* background */
 	bool was_focused;
 
+	const struct stage_rate_rule *rate_rule;
+	int64_t frame_msec;		/* Last frame done sent. */
+	uint32_t frame_seq;		/* Output frame it was decided in. */
+	bool frame_held;
+
 	struct wlr_session_lock_surface_v1 *lock_surface;
 
 	enum stage_view_type type;
 	bool slot_set;
 };
 
-#define	N_SLOTS		5
-#define	N_WORKSPACES	16
+struct stage_ext_ws_handle {
+	struct wl_resource *resource;
+	struct stage_ext_ws_group *group;
+	uint32_t state;
+	int idx;
+};
+
+struct stage_ext_ws_group {
+	struct wl_list link;
+	struct stage_ext_ws_client *client;
+	struct stage_output *out;
+	struct wl_resource *resource;
+	struct stage_ext_ws_handle handles[N_WORKSPACES];
+	int pending;		/* Workspace to activate on commit. */
+};
+
+struct stage_ext_ws_client {
+	struct wl_list link;
+	struct stage_server *server;
+	struct wl_resource *resource;
+	struct wl_list groups;
+};
 
 #ifdef STAGE_DEV
 #define	STAGE_MODIFIER	WLR_MODIFIER_ALT
@@ -212,6 +309,8 @@ struct stage_view {
 #endif
 
 static void cursor_focus(struct stage_server *server, uint32_t time);
+static void notify_state_change(struct stage_server *server);
+static void init_slots(struct wlr_box *area);
 
 static struct terminal_slot {
 	int x;
@@ -296,6 +395,8 @@ cursor_at(struct stage_server *server)
 }
 
 struct stage_layer_surface {
+	struct wl_list link;		/* stage_output::layers */
+	struct stage_output *output;
 	struct wl_listener map;
 	struct wl_listener unmap;
 	struct wl_listener surface_commit;
@@ -307,6 +408,13 @@ struct stage_layer_surface {
 	struct wlr_scene_tree *tree;
 	struct wlr_layer_surface_v1 *layer_surface;
 	struct stage_server *server;
+
+	/* What it was last arranged with, see arrange_layer(). */
+	bool dirty;
+	bool mapped;
+	struct wlr_box full_area;
+	struct wlr_box usable_in;
+	struct wlr_box usable_out;
 };
 
 static struct stage_layer_surface *
@@ -315,6 +423,8 @@ stage_layer_surface_create(struct wlr_scene_layer_surface_v1 *scene)
 	struct stage_layer_surface *surface;
 
 	surface = calloc(1, sizeof(*surface));
+	if (surface == NULL)
+		return (NULL);
 
 	surface->tree = scene->tree;
 	surface->scene = scene;
@@ -328,25 +438,156 @@ stage_layer_surface_create(struct wlr_scene_layer_surface_v1 *scene)
  * Layer surface.
  */
 
+static const enum stage_layer layer_shell_layers[] = {
+	[ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND] = STAGE_LAYER_BACKGROUND,
+	[ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM] = STAGE_LAYER_BOTTOM,
+	[ZWLR_LAYER_SHELL_V1_LAYER_TOP] = STAGE_LAYER_TOP,
+	[ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY] = STAGE_LAYER_OVERLAY,
+};
+
+static struct wlr_scene_tree *
+layer_shell_tree(struct stage_output *out,
+    enum zwlr_layer_shell_v1_layer layer)
+{
+
+	return (out->layer_trees[layer_shell_layers[layer]]);
+}
+
+/*
+ * Position the surfaces of one layer and take their exclusive zones out
+ * of the usable area.  A surface whose own state and inputs did not
+ * change since it was last arranged would come out the same, so it is
+ * not configured again: its zone is applied from the last result.
+ */
 static void
-handle_surface_commit(struct wl_listener *listener, void *data)
+arrange_layer(struct stage_output *out, enum zwlr_layer_shell_v1_layer layer,
+    bool exclusive, const struct wlr_box *full_area, struct wlr_box *usable)
 {
+	struct wlr_layer_surface_v1_state *state;
 	struct stage_layer_surface *surface;
-	struct wlr_box full_area;
+	struct wlr_box area;
+	bool mapped;
+
+	wl_list_for_each(surface, &out->layers, link) {
+		state = &surface->layer_surface->current;
+		if (!surface->layer_surface->initialized ||
+		    state->layer != layer ||
+		    (state->exclusive_zone > 0) != exclusive)
+			continue;
+
+		/* Configured before it maps, but takes no zone until then. */
+		mapped = surface->layer_surface->surface->mapped;
+
+		if (!surface->dirty && surface->mapped == mapped &&
+		    wlr_box_equal(&surface->full_area, full_area) &&
+		    wlr_box_equal(&surface->usable_in, usable)) {
+			if (mapped)
+				*usable = surface->usable_out;
+			continue;
+		}
+
+		surface->full_area = *full_area;
+		surface->usable_in = *usable;
+		surface->mapped = mapped;
+		area = *usable;
+		wlr_scene_layer_surface_v1_configure(surface->scene, full_area,
+		    &area);
+		surface->usable_out = area;
+		surface->dirty = false;
+		if (mapped)
+			*usable = area;
+	}
+}
+
+/*
+ * The terminal slots are global and belong to the first output added,
+ * the tail of the list as outputs are inserted at the head.
+ */
+static struct stage_output *
+slots_output(struct stage_server *server)
+{
 	struct stage_output *out;
-	struct stage_server *server;
 
-	printf("%s\n", __func__);
+	if (wl_list_empty(&server->outputs))
+		return (NULL);
 
-	surface = wl_container_of(listener, surface, surface_commit);
-	server = surface->server;
-	out = cursor_at(server);
+	out = wl_container_of(server->outputs.prev, out, link);
+
+	return (out);
+}
+
+/*
+ * Lay out the layer surfaces of an output, top layer first, surfaces
+ * with an exclusive zone before the others.  New windows go to slots
+ * within what is left on the output that owns them.
+ */
+static void
+arrange_layers(struct stage_output *out)
+{
+	enum zwlr_layer_shell_v1_layer layer;
+	struct wlr_box full_area, usable;
+	int exclusive;
 
-	wlr_output_effective_resolution(out->wlr_output, &full_area.width,
-	    &full_area.height);
+	wlr_output_layout_get_box(out->server->output_layout, out->wlr_output,
+	    &full_area);
+	if (wlr_box_empty(&full_area))
+		return;
 
-	wlr_layer_surface_v1_configure(surface->layer_surface, full_area.width,
+	wlr_scene_node_set_position(&out->lock_rect->node, full_area.x,
+	    full_area.y);
+	wlr_scene_rect_set_size(out->lock_rect, full_area.width,
 	    full_area.height);
+	if (out->lock_surface != NULL) {
+		wlr_scene_node_set_position(&out->lock_scene->buffer->node,
+		    full_area.x, full_area.y);
+		wlr_session_lock_surface_v1_configure(out->lock_surface,
+		    full_area.width, full_area.height);
+	}
+
+	usable = full_area;
+
+	for (exclusive = 1; exclusive >= 0; exclusive--)
+		for (layer = ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY;
+		    (int)layer >= ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND; layer--)
+			arrange_layer(out, layer, exclusive, &full_area,
+			    &usable);
+
+	if (!wlr_box_equal(&usable, &out->usable_area)) {
+		out->usable_area = usable;
+		if (out == slots_output(out->server))
+			init_slots(&usable);
+	}
+}
+
+/*
+ * Only commits that change the layer state, or the first one which
+ * needs an answer, are arranged: a plain buffer commit of a bar must
+ * not bring another configure.
+ */
+static void
+handle_surface_commit(struct wl_listener *listener, void *data)
+{
+	struct wlr_layer_surface_v1 *layer_surface;
+	struct stage_layer_surface *surface;
+
+	surface = wl_container_of(listener, surface, surface_commit);
+	layer_surface = surface->layer_surface;
+
+	if (surface->output == NULL)
+		return;
+
+	if (!layer_surface->initial_commit &&
+	    layer_surface->current.committed == 0)
+		return;
+
+	/* set_layer moves it to another subtree. */
+	if (layer_surface->current.committed & WLR_LAYER_SURFACE_V1_STATE_LAYER)
+		wlr_scene_node_reparent(&surface->tree->node,
+		    layer_shell_tree(surface->output,
+		    layer_surface->current.layer));
+
+	surface->dirty = true;
+	arrange_layers(surface->output);
 }
 
 static void
@@ -356,17 +597,50 @@ handle_map(struct wl_listener *listener, void *data)
 	printf("%s\n", __func__);
 }
 
+/* Mapping or unmapping takes or gives back the exclusive zone. */
+static void
+handle_layer_map(struct wl_listener *listener, void *data)
+{
+	struct stage_layer_surface *surface;
+
+	surface = wl_container_of(listener, surface, map);
+
+	if (surface->output != NULL)
+		arrange_layers(surface->output);
+}
+
+static void
+handle_layer_unmap(struct wl_listener *listener, void *data)
+{
+	struct stage_layer_surface *surface;
+
+	surface = wl_container_of(listener, surface, unmap);
+
+	if (surface->output != NULL)
+		arrange_layers(surface->output);
+}
+
 static void
 layer_shell_destroy(struct wl_listener *listener, void *data)
 {
 	struct stage_layer_surface *surface;
+	struct stage_output *out;
 
 	printf("%s\n", __func__);
 
 	surface = wl_container_of(listener, surface, surface_destroy);
+	out = surface->output;
 
+	wl_list_remove(&surface->map.link);
+	wl_list_remove(&surface->unmap.link);
 	wl_list_remove(&surface->surface_commit.link);
 	wl_list_remove(&surface->surface_destroy.link);
+	wl_list_remove(&surface->link);
+	free(surface);
+
+	/* Its exclusive zone is given back. */
+	if (out != NULL)
+		arrange_layers(out);
 }
 
 void
@@ -374,13 +648,10 @@ new_layer_shell_surface(struct wl_listener *listener, void *data)
 {
 	struct wlr_scene_layer_surface_v1 *scene_surface;
 	struct wlr_layer_surface_v1 *layer_surface;
-	enum zwlr_layer_shell_v1_layer layer_type;
 	struct stage_layer_surface *surface;
 	struct wlr_scene_tree *output_layer;
-	struct wlr_output *output;
 	struct stage_server *server;
 	struct stage_output *out;
-	struct wlr_box full_area;
 
 	dprintf("%s\n", __func__);
 
@@ -400,20 +671,21 @@ new_layer_shell_surface(struct wl_listener *listener, void *data)
 
 	server = wl_container_of(listener, server, new_layer_shell_surface);
 
-	out = cursor_at(server);
-	layer_type = layer_surface->pending.layer;
-
-	layer_surface->output = out->wlr_output;
-
-	wlr_output_effective_resolution(out->wlr_output, &full_area.width,
-	    &full_area.height);
+	/* Clients that leave the output to us get the cursor's. */
+	if (layer_surface->output == NULL)
+		layer_surface->output = cursor_at(server)->wlr_output;
+	out = layer_surface->output->data;
 
-	output_layer = &server->scene->tree;
+	output_layer = layer_shell_tree(out, layer_surface->pending.layer);
 
 	scene_surface = wlr_scene_layer_surface_v1_create(output_layer,
 	    layer_surface);
 
 	surface = stage_layer_surface_create(scene_surface);
+	if (surface == NULL) {
+		wlr_layer_surface_v1_destroy(layer_surface);
+		return;
+	}
 
 	printf("%s: new surface %p\n", __func__, surface);
 
@@ -423,24 +695,24 @@ new_layer_shell_surface(struct wl_listener *listener, void *data)
 	    ceil(layer_surface->output->scale));
 
 	surface->server = server;
+	surface->output = out;
+	wl_list_insert(out->layers.prev, &surface->link);
+
 	surface->surface_commit.notify = handle_surface_commit;
 	wl_signal_add(&layer_surface->surface->events.commit,
 	    &surface->surface_commit);
 	surface->surface_destroy.notify = layer_shell_destroy;
-	wl_signal_add(&layer_surface->surface->events.destroy,
+	wl_signal_add(&layer_surface->events.destroy,
 	    &surface->surface_destroy);
 
-#if 0
-	surface->map.notify = handle_map;
+	surface->map.notify = handle_layer_map;
 	wl_signal_add(&layer_surface->surface->events.map, &surface->map);
-#endif
+	surface->unmap.notify = handle_layer_unmap;
+	wl_signal_add(&layer_surface->surface->events.unmap, &surface->unmap);
 
 #if 0
 	/* TODO */
 
-	surface->unmap.notify = handle_unmap;
-	wl_signal_add(&layer_surface->surface->events.unmap, &surface->unmap);
-
 	surface->new_popup.notify = handle_new_popup;
 	wl_signal_add(&layer_surface->events.new_popup, &surface->new_popup);
 
@@ -453,6 +725,78 @@ new_layer_shell_surface(struct wl_listener *listener, void *data)
 #endif
 }
 
+/*
+ * Read-only ARGB8888 buffers drawn by stage itself, for decorations the
+ * scene shows as buffer nodes.  Pixels are premultiplied, as the
+ * renderer expects.
+ */
+struct stage_pixel_buffer {
+	struct wlr_buffer base;
+	uint32_t *data;
+	size_t stride;
+};
+
+static void
+pixel_buffer_destroy(struct wlr_buffer *wlr_buffer)
+{
+	struct stage_pixel_buffer *buffer;
+
+	buffer = wl_container_of(wlr_buffer, buffer, base);
+	free(buffer->data);
+	free(buffer);
+}
+
+static bool
+pixel_buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+    uint32_t flags, void **data, uint32_t *format, size_t *stride)
+{
+	struct stage_pixel_buffer *buffer;
+
+	buffer = wl_container_of(wlr_buffer, buffer, base);
+
+	if (flags & WLR_BUFFER_DATA_PTR_ACCESS_WRITE)
+		return (false);
+
+	*data = buffer->data;
+	*format = DRM_FORMAT_ARGB8888;
+	*stride = buffer->stride;
+
+	return (true);
+}
+
+static void
+pixel_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer)
+{
+
+}
+
+static const struct wlr_buffer_impl pixel_buffer_impl = {
+	.destroy = pixel_buffer_destroy,
+	.begin_data_ptr_access = pixel_buffer_begin_data_ptr_access,
+	.end_data_ptr_access = pixel_buffer_end_data_ptr_access,
+};
+
+static struct stage_pixel_buffer *
+pixel_buffer_create(int width, int height)
+{
+	struct stage_pixel_buffer *buffer;
+
+	buffer = calloc(1, sizeof(struct stage_pixel_buffer));
+	if (buffer == NULL)
+		return (NULL);
+
+	buffer->stride = width * 4;
+	buffer->data = calloc(height, buffer->stride);
+	if (buffer->data == NULL) {
+		free(buffer);
+		return (NULL);
+	}
+
+	wlr_buffer_init(&buffer->base, &pixel_buffer_impl, width, height);
+
+	return (buffer);
+}
+
 static void
 create_borders(struct stage_view *view)
 {
@@ -463,15 +807,42 @@ create_borders(struct stage_view *view)
 		view->rect[i] = wlr_scene_rect_create(view->scene_tree, 0, 0,
 		    color_default);
 
-	/* Background rectangle. */
+	/* Black backdrop for clients that are not fully opaque. */
 	view->bg_rect = wlr_scene_rect_create(view->scene_tree, 0, 0,
 	    (float[4]){ 0.0f, 0.0f, 0.0f, 1.0f }); /* RGBA */
+	wlr_scene_node_set_enabled(&view->bg_rect->node, false);
+}
+
+/*
+ * The backdrop is only needed where the client lets it show through:
+ * skip it when the opaque region covers the whole surface.
+ */
+static void
+view_update_backdrop(struct stage_view *view)
+{
+	struct wlr_surface *surface;
+	pixman_box32_t box;
+	bool opaque;
+
+	if (view->bg_rect == NULL)
+		return;
+
+	surface = view->xdg_toplevel->base->surface;
+
+	box.x1 = 0;
+	box.y1 = 0;
+	box.x2 = surface->current.width;
+	box.y2 = surface->current.height;
+
+	opaque = pixman_region32_contains_rectangle(&surface->opaque_region,
+	    &box) == PIXMAN_REGION_IN;
+
+	wlr_scene_node_set_enabled(&view->bg_rect->node, !opaque);
 }
 
 static void
 update_borders(struct stage_view *view)
 {
-	struct wlr_scene_rect *rect;
 
 	/* left */
 	wlr_scene_node_set_position(&view->rect[0]->node, 0, 0);
@@ -508,7 +879,7 @@ view_geometry(struct stage_view *view, struct wlr_box *geom)
 		//geom->width = 100;
 		//geom->height = 100;
 	} else
-		geom = &view->xdg_toplevel->base->geometry;
+		*geom = view->xdg_toplevel->base->geometry;
 }
 
 static void
@@ -595,6 +966,25 @@ focus_view(struct stage_view *view, struct wlr_surface *surface)
 	wlr_seat_keyboard_notify_enter(seat, view_surface(view),
 	    kb->keycodes, kb->num_keycodes, &kb->modifiers);
 	view_set_borders_active(view, true);
+
+	notify_state_change(server);
+}
+
+/* The view a scene node belongs to, if any. */
+static struct stage_view *
+view_from_node(struct wlr_scene_node *node)
+{
+	struct wlr_scene_tree *tree;
+
+	tree = node->parent;
+
+	while (tree != NULL && tree->node.data == NULL)
+		tree = tree->node.parent;
+
+	if (tree == NULL)
+		return (NULL);
+
+	return (tree->node.data);
 }
 
 static struct stage_view *
@@ -604,7 +994,6 @@ desktop_view_at(struct stage_server *server, double lx, double ly,
 	struct wlr_scene_surface *scene_surface;
 	struct wlr_scene_buffer *scene_buffer;
 	struct wlr_scene_node *node;
-	struct wlr_scene_tree *tree;
 	struct stage_view *view;
 	struct stage_output *out;
 	struct stage_workspace *ws;
@@ -625,7 +1014,17 @@ desktop_view_at(struct stage_server *server, double lx, double ly,
 #endif
 
 #if 1
-	node = wlr_scene_node_at(&server->scene->tree.node, lx, ly, sx, sy);
+	/*
+	 * Top to bottom.  While locked only the lock surfaces take input,
+	 * otherwise the lock layer is empty.
+	 */
+	node = NULL;
+	for (i = STAGE_NLAYERS - 1; i >= 0 && node == NULL; i--) {
+		if ((i == STAGE_LAYER_LOCK) != server->locked)
+			continue;
+		node = wlr_scene_node_at(&server->layer_trees[i]->node, lx, ly,
+		    sx, sy);
+	}
 	if (node == NULL)
 		return (NULL);
 
@@ -638,15 +1037,7 @@ desktop_view_at(struct stage_server *server, double lx, double ly,
 		*surface = scene_surface->surface;
 	}
 
-	tree = node->parent;
-
-	while (tree != NULL && tree->node.data == NULL)
-		tree = tree->node.parent;
-
-	if (tree == NULL)
-		return (NULL);
-
-	view = tree->node.data;
+	view = view_from_node(node);
 #endif
 
 	return (view);
@@ -763,36 +1154,47 @@ xdg_toplevel_map(struct wl_listener *listener, void *data)
 		return;
 
 	update_borders(view);
-	focus_view(view, view_surface(view));
+
+	/*
+	 * Behind the lock screen the view waits suspended and unfocused,
+	 * like the others on the shown workspaces; unlock restores both.
+	 */
+	if (view->server->locked)
+		wlr_xdg_toplevel_set_suspended(view->xdg_toplevel, true);
+	else
+		focus_view(view, view_surface(view));
+	notify_state_change(view->server);
 }
 
 void
 slock_destroy_view(struct wl_listener *listener, void *data)
 {
-	struct wlr_session_lock_surface_v1 *lock_surface;
+	struct stage_output *out;
 	struct stage_view *view;
 
 	view = wl_container_of(listener, view, destroy);
 
 	printf("%s\n", __func__);
 
-	lock_surface = view->lock_surface;
+	wl_list_for_each(out, &view->server->outputs, link)
+		if (out->lock_surface == view->lock_surface) {
+			out->lock_surface = NULL;
+			out->lock_scene = NULL;
+		}
 
 	wl_list_remove(&view->map.link);
 	wl_list_remove(&view->destroy.link);
+	free(view);
 }
 
 static void
 slock_map_view(struct wl_listener *listener, void *data)
 {
-	struct wlr_session_lock_surface_v1 *lock_surface;
 	struct stage_view *view;
 
 	printf("%s\n", __func__);
 
 	view = wl_container_of(listener, view, map);
-
-	lock_surface = view->lock_surface;
 }
 
 void
@@ -804,6 +1206,7 @@ slock_new_surface(struct wl_listener *listener, void *data)
 	struct stage_view *view;
 	struct wlr_scene_surface *surface;
 	struct wlr_session_lock_v1 *lock;
+	struct wlr_box box;
 
 	printf("%s\n", __func__);
 
@@ -823,23 +1226,67 @@ slock_new_surface(struct wl_listener *listener, void *data)
 	view->destroy.notify = slock_destroy_view;
 	wl_signal_add(&lock_surface->events.destroy, &view->destroy);
 
-	/* TODO: destroy surface when not needed? */
-	surface = wlr_scene_surface_create(&server->scene->tree,
+	struct wlr_output *output;
+	struct stage_output *out;
+	output = lock_surface->output;
+	out = output->data;
+
+	/* Goes with the lock surface, or with the output's subtree. */
+	surface = wlr_scene_surface_create(out->layer_trees[STAGE_LAYER_LOCK],
 	    lock_surface->surface);
 	view->scene_tree = NULL;
 	view->lock_surface->data = surface;
 
-	struct wlr_output *output;
-	struct stage_output *out;
-	out = cursor_at(server);
-	output = out->wlr_output;
-	view->w = output->width;
-	view->h = output->height;
+	wlr_output_layout_get_box(server->output_layout, output, &box);
+	wlr_scene_node_set_position(&surface->buffer->node, box.x, box.y);
+	out->lock_surface = lock_surface;
+	out->lock_scene = surface;
+
+	view->w = box.width;
+	view->h = box.height;
 	wlr_session_lock_surface_v1_configure(lock_surface, view->w, view->h);
 
 	focus_view(view, view_surface(view));
 }
 
+/*
+ * While locked only the lock layer is shown: every output has a blank
+ * rect there, covered by its lock surface once the client maps one.
+ * Everything else is disabled in the scene, so it is neither rendered
+ * nor sent frame callbacks, and the views on shown workspaces are
+ * suspended as well.  Unlock gives keyboard focus to the latest view on
+ * the workspace under the cursor.
+ */
+static void
+server_set_locked(struct stage_server *server, bool locked)
+{
+	struct stage_workspace *ws;
+	struct stage_output *out;
+	struct stage_view *view;
+	int i;
+
+	server->locked = locked;
+
+	for (i = 0; i < STAGE_NLAYERS; i++)
+		wlr_scene_node_set_enabled(&server->layer_trees[i]->node,
+		    (i == STAGE_LAYER_LOCK) == locked);
+
+	wl_list_for_each(out, &server->outputs, link)
+		wl_list_for_each(view, &workspaces[out->curws].views, link)
+			wlr_xdg_toplevel_set_suspended(view->xdg_toplevel,
+			    locked);
+
+	if (locked)
+		return;
+
+	/* Keyboard focus went to the lock surface, hand it back. */
+	ws = &workspaces[cursor_at(server)->curws];
+	if (!wl_list_empty(&ws->views)) {
+		view = wl_container_of(ws->views.next, view, link);
+		focus_view(view, view_surface(view));
+	}
+}
+
 void
 slock_unlock(struct wl_listener *listener, void *data)
 {
@@ -851,7 +1298,7 @@ slock_unlock(struct wl_listener *listener, void *data)
 	printf("%s\n", __func__);
 
 	server = slock->server;
-	server->locked = false;
+	server_set_locked(server, false);
 }
 
 void
@@ -879,192 +1326,1174 @@ new_lock(struct wl_listener *listener, void *data)
 
 	server = wl_container_of(listener, server, new_lock);
 
-	lock = data;
+	lock = data;
+
+	slock = malloc(sizeof(struct stage_lock));
+	slock->lock = lock;
+	slock->server = server;
+	//lock->data = slock;
+
+	slock->new_surface.notify = slock_new_surface;
+	wl_signal_add(&lock->events.new_surface, &slock->new_surface);
+
+	slock->unlock.notify = slock_unlock;
+	wl_signal_add(&lock->events.unlock, &slock->unlock);
+
+	slock->destroy.notify = slock_destroy;
+	wl_signal_add(&lock->events.destroy, &slock->destroy);
+
+	printf("%s\n", __func__);
+	server_set_locked(server, true);
+	wlr_session_lock_v1_send_locked(lock);
+}
+
+void
+request_activate(struct wl_listener *listener, void *data)
+{
+
+	printf("%s\n", __func__);
+}
+
+void
+layout_change(struct wl_listener *listener, void *data)
+{
+	struct stage_server *server;
+	struct stage_output *out;
+
+	printf("%s\n", __func__);
+
+	server = wl_container_of(listener, server, layout_change);
+
+	/* Outputs moved or changed mode: their layer surfaces follow. */
+	wl_list_for_each(out, &server->outputs, link)
+		arrange_layers(out);
+}
+
+void
+output_manager_apply(struct wl_listener *listener, void *data)
+{
+
+	printf("%s\n", __func__);
+}
+
+void
+output_manager_test(struct wl_listener *listener, void *data)
+{
+
+	printf("%s\n", __func__);
+}
+
+static struct stage_view *
+view_from_surface(struct stage_server *server, struct wlr_surface *surface)
+{
+	struct wlr_xdg_surface *xdg_surface;
+	struct wlr_scene_node *scene_node;
+	struct stage_view *view;
+
+	xdg_surface = wlr_xdg_surface_try_from_wlr_surface(surface);
+	if (xdg_surface == NULL)
+		return (NULL);
+
+	scene_node = xdg_surface->data;
+
+	view = scene_node->data;
+
+	assert(view != NULL);
+
+	return (view);
+}
+
+static void
+state_publish(struct stage_server *server)
+{
+	struct stage_state_output *so;
+	struct wlr_surface *surface;
+	struct stage_output *out;
+	struct stage_view *view;
+	struct stage_state *st;
+	const char *app_id;
+	int i;
+
+	st = server->state;
+	if (st == NULL)
+		return;
+
+	app_id = NULL;
+	surface = server->seat->keyboard_state.focused_surface;
+	if (surface) {
+		view = view_from_surface(server, surface);
+		if (view)
+			app_id = get_app_id(view);
+	}
+
+	state_write_begin(st);
+
+	st->oldws = server->oldws;
+	st->layout = server->current_layout;
+	st->occupied = 0;
+	for (i = 0; i < N_WORKSPACES; i++) {
+		st->ws_names[i] = workspaces[i].name;
+		if (!wl_list_empty(&workspaces[i].views))
+			st->occupied |= (1 << i);
+	}
+
+	i = 0;
+	wl_list_for_each(out, &server->outputs, link) {
+		if (i == STATE_MAX_OUTPUTS)
+			break;
+		so = &st->outputs[i++];
+		snprintf(so->name, sizeof(so->name), "%s",
+		    out->wlr_output->name);
+		so->curws = out->curws;
+	}
+	st->noutputs = i;
+
+	snprintf(st->app_id, sizeof(st->app_id), "%s",
+	    app_id ? app_id : "");
+
+	state_write_end(st);
+	state_wake(st);
+}
+
+/*
+ * The pointer moved.  The cursor slot is only written from output_frame,
+ * so however fast the device reports, readers see one update per frame.
+ * No frame is asked for here: moving the cursor, on a hardware plane or
+ * not, already makes its output need one.
+ */
+static void
+state_cursor_moved(struct stage_server *server)
+{
+
+	if (server->state != NULL)
+		server->cursor_moved = true;
+}
+
+static void
+state_cursor_publish(struct stage_server *server)
+{
+	int32_t x, y;
+
+	if (!server->cursor_moved)
+		return;
+
+	server->cursor_moved = false;
+
+	x = (int32_t)server->cursor->x;
+	y = (int32_t)server->cursor->y;
+	if (x == server->state->cursor_x && y == server->state->cursor_y)
+		return;
+
+	/* Readers sleep on the slot: wake them only for a new position. */
+	state_cursor_write(server->state, x, y);
+	state_cursor_wake(server->state);
+}
+
+static int
+state_accept(int fd, uint32_t mask, void *data)
+{
+	struct stage_server *server;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+	char c;
+	int sock;
+
+	server = data;
+
+	sock = accept(fd, NULL, NULL);
+	if (sock < 0)
+		return (0);
+
+	c = 'S';
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+
+	memset(&msg, 0, sizeof(struct msghdr));
+	memset(&cbuf, 0, sizeof(cbuf));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof(cbuf.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &server->state_fd, sizeof(int));
+
+	if (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0)
+		printf("%s: sendmsg failed: %s\n", __func__, strerror(errno));
+
+	close(sock);
+
+	return (0);
+}
+
+static int
+state_init(struct stage_server *server)
+{
+	struct sockaddr_un addr;
+	struct wl_event_loop *loop;
+	struct stage_state *st;
+	char path[64];
+	int sock;
+	int rfd;
+	int fd;
+
+	fd = memfd_create("stage-state", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		printf("%s: memfd_create failed: %s\n", __func__,
+		    strerror(errno));
+		return (-1);
+	}
+
+	if (ftruncate(fd, sizeof(struct stage_state)) != 0) {
+		printf("%s: ftruncate failed: %s\n", __func__,
+		    strerror(errno));
+		goto fail_fd;
+	}
+
+	st = mmap(NULL, sizeof(struct stage_state), PROT_READ | PROT_WRITE,
+	    MAP_SHARED, fd, 0);
+	if (st == MAP_FAILED) {
+		printf("%s: mmap failed: %s\n", __func__, strerror(errno));
+		goto fail_fd;
+	}
+
+	/* Readers must not resize the page. */
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0)
+		printf("%s: F_ADD_SEALS failed: %s\n", __func__,
+		    strerror(errno));
+
+	/*
+	 * Nor write it, or they could corrupt the seqlock every other
+	 * reader trusts.  Seal off writable mappings of the memfd, and if
+	 * the kernel cannot, hand out a read-only reopen of it instead.
+	 */
+	rfd = -1;
+#ifdef F_SEAL_FUTURE_WRITE
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE) == 0)
+		rfd = fd;
+#endif
+	if (rfd < 0) {
+		snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+		rfd = open(path, O_RDONLY | O_CLOEXEC);
+		if (rfd < 0) {
+			printf("%s: no read-only descriptor: %s\n", __func__,
+			    strerror(errno));
+			goto fail_unmap;
+		}
+	}
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SEAL);
+
+	memset(st, 0, sizeof(struct stage_state));
+	st->magic = STATE_MAGIC;
+	st->version = STATE_VERSION;
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		printf("%s: socket failed: %s\n", __func__, strerror(errno));
+		goto fail_rfd;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, STATE_SOCK_FILE);
+	unlink(STATE_SOCK_FILE);
+
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(sock, 8) < 0) {
+		printf("%s: bind failed: %s\n", __func__, strerror(errno));
+		goto fail_sock;
+	}
+
+	/* The mapping is all stage needs; readers get rfd. */
+	if (rfd != fd)
+		close(fd);
+
+	server->state = st;
+	server->state_fd = rfd;
+	server->state_sock = sock;
+
+	loop = wl_display_get_event_loop(server->wl_disp);
+	server->state_source = wl_event_loop_add_fd(loop, sock,
+	    WL_EVENT_READABLE, state_accept, server);
+
+	return (0);
+
+fail_sock:
+	close(sock);
+fail_rfd:
+	if (rfd != fd)
+		close(rfd);
+fail_unmap:
+	munmap(st, sizeof(struct stage_state));
+fail_fd:
+	close(fd);
+
+	return (-1);
+}
+
+static void
+changeworkspace_output(struct stage_server *server, struct stage_output *out,
+    int newws)
+{
+	struct stage_workspace *ws;
+	struct stage_view *view, *tmpview;
+	struct stage_view *focused_view;
+	struct wlr_surface *surface;
+	struct wlr_seat *seat;
+	int oldws;
+
+	if (out->curws == newws)
+		return;
+
+	oldws = out->curws;
+	server->oldws = oldws;
+	out->curws = newws;
+
+	focused_view = NULL;
+	seat = server->seat;
+	surface = seat->keyboard_state.focused_surface;
+	if (surface)
+		focused_view = view_from_surface(server, surface);
+
+	dprintf("%s: ws %d -> %d\n", __func__, oldws, newws);
+
+	/*
+	 * Views on the workspace going away are suspended, so clients can
+	 * stop drawing frames nobody sees until it is shown again.
+	 */
+	ws = &workspaces[oldws];
+	wl_list_for_each_safe(view, tmpview, &ws->views, link) {
+		wlr_scene_node_set_enabled(&view->scene_tree->node, false);
+		wlr_xdg_toplevel_set_suspended(view->xdg_toplevel, true);
+		if (view == focused_view)
+			view->was_focused = true;
+		else
+			view->was_focused = false;
+	}
+
+	ws = &workspaces[newws];
+	wl_list_for_each_safe(view, tmpview, &ws->views, link) {
+		wlr_scene_node_set_enabled(&view->scene_tree->node, true);
+		wlr_xdg_toplevel_set_suspended(view->xdg_toplevel, false);
+		if (view->was_focused)
+			focus_view(view, view_surface(view));
+	}
+
+	cursor_focus(server, 0);
+	notify_state_change(server);
+}
+
+static void
+changeworkspace(struct stage_server *server, int newws)
+{
+
+	changeworkspace_output(server, cursor_at(server), newws);
+}
+
+/*
+ * ext-workspace-v1.
+ *
+ * Every output is a workspace group holding its own handle for each of
+ * the N_WORKSPACES workspaces.  A workspace is active in the group when
+ * it is the output's curws, and hidden when it is neither active nor
+ * occupied, so bars show the same set the old strip did.
+ */
+
+#define	EXT_WS_VERSION	1
+
+static const struct ext_workspace_manager_v1_interface ext_ws_manager_impl;
+static const struct ext_workspace_group_handle_v1_interface ext_ws_group_impl;
+static const struct ext_workspace_handle_v1_interface ext_ws_handle_impl;
+
+static uint32_t
+ext_ws_state(struct stage_output *out, int i)
+{
+	uint32_t state;
+
+	state = 0;
+
+	if (out->curws == i)
+		state |= EXT_WORKSPACE_HANDLE_V1_STATE_ACTIVE;
+	else if (wl_list_empty(&workspaces[i].views))
+		state |= EXT_WORKSPACE_HANDLE_V1_STATE_HIDDEN;
+
+	return (state);
+}
+
+static void
+ext_ws_handle_resource_destroy(struct wl_resource *resource)
+{
+	struct stage_ext_ws_handle *handle;
+
+	handle = wl_resource_get_user_data(resource);
+	if (handle != NULL)
+		handle->resource = NULL;
+}
+
+static void
+ext_ws_group_resource_destroy(struct wl_resource *resource)
+{
+	struct stage_ext_ws_group *group;
+
+	group = wl_resource_get_user_data(resource);
+	if (group != NULL)
+		group->resource = NULL;
+}
+
+static void
+ext_ws_group_free(struct stage_ext_ws_group *group)
+{
+	struct stage_ext_ws_handle *handle;
+	int i;
+
+	for (i = 0; i < N_WORKSPACES; i++) {
+		handle = &group->handles[i];
+		if (handle->resource != NULL)
+			wl_resource_set_user_data(handle->resource, NULL);
+	}
+
+	if (group->resource != NULL)
+		wl_resource_set_user_data(group->resource, NULL);
+
+	wl_list_remove(&group->link);
+	free(group);
+}
+
+static void
+ext_ws_group_output_enter(struct stage_ext_ws_group *group,
+    struct wl_resource *output_resource)
+{
+
+	if (group->resource == NULL)
+		return;
+
+	if (wl_resource_get_client(output_resource) !=
+	    wl_resource_get_client(group->resource))
+		return;
+
+	ext_workspace_group_handle_v1_send_output_enter(group->resource,
+	    output_resource);
+}
+
+static void
+ext_ws_group_create(struct stage_ext_ws_client *client,
+    struct stage_output *out)
+{
+	struct stage_ext_ws_handle *handle;
+	struct stage_ext_ws_group *group;
+	struct wl_resource *resource;
+	struct wl_client *wl_client;
+	char id[64];
+	char name[2];
+	int i, n;
+
+	wl_client = wl_resource_get_client(client->resource);
+
+	group = calloc(1, sizeof(struct stage_ext_ws_group));
+	if (group == NULL)
+		return;
+
+	group->client = client;
+	group->out = out;
+	group->pending = -1;
+
+	group->resource = wl_resource_create(wl_client,
+	    &ext_workspace_group_handle_v1_interface,
+	    wl_resource_get_version(client->resource), 0);
+	if (group->resource == NULL) {
+		free(group);
+		return;
+	}
+	wl_resource_set_implementation(group->resource, &ext_ws_group_impl,
+	    group, ext_ws_group_resource_destroy);
+	wl_list_insert(client->groups.prev, &group->link);
+
+	ext_workspace_manager_v1_send_workspace_group(client->resource,
+	    group->resource);
+	ext_workspace_group_handle_v1_send_capabilities(group->resource, 0);
+
+	wl_resource_for_each(resource, &out->wlr_output->resources)
+		ext_ws_group_output_enter(group, resource);
+
+	/* Same order as the strip: workspace 1 first, workspace 0 last. */
+	for (n = 1; n <= N_WORKSPACES; n++) {
+		i = n % N_WORKSPACES;
+		handle = &group->handles[i];
+		handle->group = group;
+		handle->idx = i;
+		handle->state = ext_ws_state(out, i);
+
+		handle->resource = wl_resource_create(wl_client,
+		    &ext_workspace_handle_v1_interface,
+		    wl_resource_get_version(client->resource), 0);
+		if (handle->resource == NULL)
+			continue;
+		wl_resource_set_implementation(handle->resource,
+		    &ext_ws_handle_impl, handle,
+		    ext_ws_handle_resource_destroy);
+
+		snprintf(id, sizeof(id), "%s-%d", out->wlr_output->name, i);
+		name[0] = workspaces[i].name;
+		name[1] = '\0';
+
+		ext_workspace_manager_v1_send_workspace(client->resource,
+		    handle->resource);
+		ext_workspace_handle_v1_send_id(handle->resource, id);
+		ext_workspace_handle_v1_send_name(handle->resource, name);
+		ext_workspace_handle_v1_send_capabilities(handle->resource,
+		    EXT_WORKSPACE_HANDLE_V1_WORKSPACE_CAPABILITIES_ACTIVATE);
+		ext_workspace_handle_v1_send_state(handle->resource,
+		    handle->state);
+		ext_workspace_group_handle_v1_send_workspace_enter(
+		    group->resource, handle->resource);
+	}
+}
+
+static void
+ext_ws_group_remove(struct stage_ext_ws_group *group)
+{
+	struct stage_ext_ws_handle *handle;
+	int i;
+
+	for (i = 0; i < N_WORKSPACES; i++) {
+		handle = &group->handles[i];
+		if (handle->resource == NULL)
+			continue;
+		if (group->resource != NULL)
+			ext_workspace_group_handle_v1_send_workspace_leave(
+			    group->resource, handle->resource);
+		ext_workspace_handle_v1_send_removed(handle->resource);
+	}
+
+	if (group->resource != NULL)
+		ext_workspace_group_handle_v1_send_removed(group->resource);
+
+	ext_ws_group_free(group);
+}
+
+static void
+ext_ws_handle_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+
+	wl_resource_destroy(resource);
+}
+
+static void
+ext_ws_handle_activate(struct wl_client *client,
+    struct wl_resource *resource)
+{
+	struct stage_ext_ws_handle *handle;
+
+	handle = wl_resource_get_user_data(resource);
+	if (handle == NULL)
+		return;
+
+	handle->group->pending = handle->idx;
+}
+
+static void
+ext_ws_handle_deactivate(struct wl_client *client,
+    struct wl_resource *resource)
+{
+
+	/* An output always shows exactly one workspace. */
+}
+
+static void
+ext_ws_handle_assign(struct wl_client *client, struct wl_resource *resource,
+    struct wl_resource *group_resource)
+{
+
+	/* Not supported: the capability is not advertised. */
+}
+
+static void
+ext_ws_handle_remove(struct wl_client *client, struct wl_resource *resource)
+{
+
+	/* Not supported: the capability is not advertised. */
+}
+
+static const struct ext_workspace_handle_v1_interface ext_ws_handle_impl = {
+	.destroy = ext_ws_handle_destroy,
+	.activate = ext_ws_handle_activate,
+	.deactivate = ext_ws_handle_deactivate,
+	.assign = ext_ws_handle_assign,
+	.remove = ext_ws_handle_remove,
+};
+
+static void
+ext_ws_group_create_workspace(struct wl_client *client,
+    struct wl_resource *resource, const char *workspace)
+{
+
+	/* Not supported: the capability is not advertised. */
+}
+
+static void
+ext_ws_group_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+
+	wl_resource_destroy(resource);
+}
+
+static const struct ext_workspace_group_handle_v1_interface
+    ext_ws_group_impl = {
+	.create_workspace = ext_ws_group_create_workspace,
+	.destroy = ext_ws_group_destroy,
+};
+
+static void
+ext_ws_manager_commit(struct wl_client *wl_client,
+    struct wl_resource *resource)
+{
+	struct stage_ext_ws_client *client;
+	struct stage_ext_ws_group *group, *tmp;
+	int newws;
+
+	client = wl_resource_get_user_data(resource);
+	if (client == NULL)
+		return;
+
+	wl_list_for_each_safe(group, tmp, &client->groups, link) {
+		if (group->pending < 0)
+			continue;
+		newws = group->pending;
+		group->pending = -1;
+		if (!client->server->locked)
+			changeworkspace_output(client->server, group->out,
+			    newws);
+	}
+}
+
+static void
+ext_ws_manager_stop(struct wl_client *wl_client,
+    struct wl_resource *resource)
+{
+
+	ext_workspace_manager_v1_send_finished(resource);
+	wl_resource_destroy(resource);
+}
+
+static const struct ext_workspace_manager_v1_interface ext_ws_manager_impl = {
+	.commit = ext_ws_manager_commit,
+	.stop = ext_ws_manager_stop,
+};
+
+static void
+ext_ws_manager_resource_destroy(struct wl_resource *resource)
+{
+	struct stage_ext_ws_group *group, *tmp;
+	struct stage_ext_ws_client *client;
+
+	client = wl_resource_get_user_data(resource);
+	if (client == NULL)
+		return;
+
+	wl_list_for_each_safe(group, tmp, &client->groups, link)
+		ext_ws_group_free(group);
+
+	wl_list_remove(&client->link);
+	free(client);
+}
+
+static void
+ext_ws_bind(struct wl_client *wl_client, void *data, uint32_t version,
+    uint32_t id)
+{
+	struct stage_ext_ws_client *client;
+	struct stage_server *server;
+	struct stage_output *out;
+
+	server = data;
+
+	client = calloc(1, sizeof(struct stage_ext_ws_client));
+	if (client == NULL) {
+		wl_client_post_no_memory(wl_client);
+		return;
+	}
+
+	client->resource = wl_resource_create(wl_client,
+	    &ext_workspace_manager_v1_interface, version, id);
+	if (client->resource == NULL) {
+		free(client);
+		wl_client_post_no_memory(wl_client);
+		return;
+	}
+
+	client->server = server;
+	wl_list_init(&client->groups);
+	wl_resource_set_implementation(client->resource, &ext_ws_manager_impl,
+	    client, ext_ws_manager_resource_destroy);
+	wl_list_insert(&server->ext_ws_clients, &client->link);
+
+	wl_list_for_each(out, &server->outputs, link)
+		ext_ws_group_create(client, out);
+
+	ext_workspace_manager_v1_send_done(client->resource);
+}
+
+/* Send the state of every workspace that changed, in one done batch. */
+static void
+ext_workspace_update(struct stage_server *server)
+{
+	struct stage_ext_ws_handle *handle;
+	struct stage_ext_ws_client *client;
+	struct stage_ext_ws_group *group;
+	uint32_t state;
+	bool changed;
+	int i;
+
+	wl_list_for_each(client, &server->ext_ws_clients, link) {
+		changed = false;
+		wl_list_for_each(group, &client->groups, link) {
+			for (i = 0; i < N_WORKSPACES; i++) {
+				handle = &group->handles[i];
+				state = ext_ws_state(group->out, i);
+				if (handle->state == state)
+					continue;
+				handle->state = state;
+				if (handle->resource == NULL)
+					continue;
+				ext_workspace_handle_v1_send_state(
+				    handle->resource, state);
+				changed = true;
+			}
+		}
+		if (changed)
+			ext_workspace_manager_v1_send_done(client->resource);
+	}
+}
+
+static void
+ext_workspace_output_add(struct stage_server *server,
+    struct stage_output *out)
+{
+	struct stage_ext_ws_client *client;
+
+	wl_list_for_each(client, &server->ext_ws_clients, link) {
+		ext_ws_group_create(client, out);
+		ext_workspace_manager_v1_send_done(client->resource);
+	}
+}
+
+static void
+ext_workspace_output_remove(struct stage_server *server,
+    struct stage_output *out)
+{
+	struct stage_ext_ws_group *group, *tmp;
+	struct stage_ext_ws_client *client;
+
+	wl_list_for_each(client, &server->ext_ws_clients, link) {
+		wl_list_for_each_safe(group, tmp, &client->groups, link)
+			if (group->out == out)
+				ext_ws_group_remove(group);
+		ext_workspace_manager_v1_send_done(client->resource);
+	}
+}
+
+static void
+ext_workspace_output_bind(struct stage_server *server,
+    struct stage_output *out, struct wl_resource *output_resource)
+{
+	struct stage_ext_ws_client *client;
+	struct stage_ext_ws_group *group;
+
+	wl_list_for_each(client, &server->ext_ws_clients, link) {
+		if (wl_resource_get_client(client->resource) !=
+		    wl_resource_get_client(output_resource))
+			continue;
+		wl_list_for_each(group, &client->groups, link)
+			if (group->out == out)
+				ext_ws_group_output_enter(group,
+				    output_resource);
+		ext_workspace_manager_v1_send_done(client->resource);
+	}
+}
+
+/*
+ * Built-in workspace indicator (stage -i).
+ *
+ * A column of cells at the right edge of every output, showing the same
+ * set as the ws strip.  Glyphs come from a small bitmap font and are
+ * rendered once per workspace and state into buffers that every output
+ * shares; an update only swaps buffers on scene nodes, so the indicator
+ * changes in the very frame that shows the new workspace.
+ */
+
+#define	IND_SCALE	6
+#define	IND_CELL_W	(IND_SCALE * 7)
+#define	IND_CELL_H	(IND_SCALE * 9)
+#define	IND_Y		100
+#define	IND_BG		0xff000000
+
+enum {
+	IND_HIDDEN = -1,
+	IND_CURRENT,
+	IND_PREVIOUS,
+	IND_OCCUPIED,
+	IND_NSTATES,
+};
+
+static const uint32_t indicator_colors[IND_NSTATES] = {
+	0xffffffff, 0xff999999, 0xff444444,
+};
+
+/* 5x7 glyphs, indexed like workspaces[]: 0-9 - = \ ` t s */
+static const uint8_t indicator_font[N_WORKSPACES][7] = {
+	{ 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e },
+	{ 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e },
+	{ 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f },
+	{ 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e },
+	{ 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 },
+	{ 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e },
+	{ 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e },
+	{ 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+	{ 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e },
+	{ 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c },
+	{ 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00 },
+	{ 0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00 },
+	{ 0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00 },
+	{ 0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00 },
+	{ 0x08, 0x08, 0x1c, 0x08, 0x08, 0x09, 0x06 },
+	{ 0x00, 0x00, 0x0e, 0x10, 0x0e, 0x01, 0x1e },
+};
+
+static struct wlr_buffer *indicator_glyphs[N_WORKSPACES][IND_NSTATES];
+
+static struct wlr_buffer *
+indicator_glyph(int ws, int state)
+{
+	struct stage_pixel_buffer *buffer;
+	int row, col;
+	bool on;
+	int x, y;
 
-	slock = malloc(sizeof(struct stage_lock));
-	slock->lock = lock;
-	slock->server = server;
-	//lock->data = slock;
+	if (indicator_glyphs[ws][state] != NULL)
+		return (indicator_glyphs[ws][state]);
 
-	slock->new_surface.notify = slock_new_surface;
-	wl_signal_add(&lock->events.new_surface, &slock->new_surface);
+	buffer = pixel_buffer_create(IND_CELL_W, IND_CELL_H);
+	if (buffer == NULL)
+		return (NULL);
 
-	slock->unlock.notify = slock_unlock;
-	wl_signal_add(&lock->events.unlock, &slock->unlock);
+	/* One cell of margin around the 5x7 glyph. */
+	for (y = 0; y < IND_CELL_H; y++)
+		for (x = 0; x < IND_CELL_W; x++) {
+			row = y / IND_SCALE - 1;
+			col = x / IND_SCALE - 1;
+			on = row >= 0 && row < 7 && col >= 0 && col < 5 &&
+			    (indicator_font[ws][row] & (0x10 >> col));
+			buffer->data[y * IND_CELL_W + x] = on ?
+			    indicator_colors[state] : IND_BG;
+		}
 
-	slock->destroy.notify = slock_destroy;
-	wl_signal_add(&lock->events.destroy, &slock->destroy);
+	indicator_glyphs[ws][state] = &buffer->base;
 
-	printf("%s\n", __func__);
-	wlr_session_lock_v1_send_locked(lock);
-	server->locked = true;
+	return (&buffer->base);
 }
 
-void
-request_activate(struct wl_listener *listener, void *data)
+/*
+ * The indicator is drawn over windows but must not take their input:
+ * a hit on a cell would end desktop_view_at() on a buffer that is not
+ * a surface.
+ */
+static bool
+indicator_accepts_input(struct wlr_scene_buffer *buffer, double *sx,
+    double *sy)
 {
 
-	printf("%s\n", __func__);
+	return (false);
 }
 
-void
-layout_change(struct wl_listener *listener, void *data)
+static void
+indicator_create(struct stage_server *server, struct stage_output *out)
 {
+	int i;
 
-	printf("%s\n", __func__);
+	/* Overlay layer, above windows and the top layer panels. */
+	out->indicator = wlr_scene_tree_create(
+	    out->layer_trees[STAGE_LAYER_OVERLAY]);
+	for (i = 0; i < N_WORKSPACES; i++) {
+		out->ind_cells[i] = wlr_scene_buffer_create(out->indicator,
+		    NULL);
+		out->ind_cells[i]->point_accepts_input =
+		    indicator_accepts_input;
+		wlr_scene_node_set_enabled(&out->ind_cells[i]->node, false);
+		out->ind_state[i] = IND_HIDDEN;
+	}
 }
 
-void
-output_manager_apply(struct wl_listener *listener, void *data)
+static void
+indicator_update(struct stage_server *server)
 {
+	struct wlr_scene_buffer *cell;
+	struct stage_output *out;
+	struct wlr_box box;
+	int state;
+	int row;
+	int i, n;
 
-	printf("%s\n", __func__);
+	if (!server->indicator)
+		return;
+
+	wl_list_for_each(out, &server->outputs, link) {
+		if (out->indicator == NULL)
+			indicator_create(server, out);
+
+		wlr_output_layout_get_box(server->output_layout,
+		    out->wlr_output, &box);
+		if (wlr_box_empty(&box))
+			continue;
+
+		wlr_scene_node_set_position(&out->indicator->node,
+		    box.x + box.width - IND_CELL_W, box.y + IND_Y);
+
+		/* Same order as the ext-workspace groups: 1 .. s, then 0. */
+		row = 0;
+		for (n = 1; n <= N_WORKSPACES; n++) {
+			i = n % N_WORKSPACES;
+			cell = out->ind_cells[i];
+
+			if (i == out->curws)
+				state = IND_CURRENT;
+			else if (wl_list_empty(&workspaces[i].views))
+				state = IND_HIDDEN;
+			else if (i == server->oldws)
+				state = IND_PREVIOUS;
+			else
+				state = IND_OCCUPIED;
+
+			if (state == IND_HIDDEN) {
+				wlr_scene_node_set_enabled(&cell->node, false);
+				out->ind_state[i] = state;
+				continue;
+			}
+
+			if (out->ind_state[i] != state) {
+				wlr_scene_buffer_set_buffer(cell,
+				    indicator_glyph(i, state));
+				out->ind_state[i] = state;
+			}
+			wlr_scene_node_set_position(&cell->node, 0,
+			    row++ * IND_CELL_H);
+			wlr_scene_node_set_enabled(&cell->node, true);
+		}
+	}
 }
 
-void
-output_manager_test(struct wl_listener *listener, void *data)
+static void
+notify_state_change(struct stage_server *server)
 {
 
-	printf("%s\n", __func__);
+	state_publish(server);
+	ext_workspace_update(server);
+	indicator_update(server);
 }
 
-static struct stage_view *
-view_from_surface(struct stage_server *server, struct wlr_surface *surface)
-{
-	struct wlr_xdg_surface *xdg_surface;
-	struct wlr_scene_node *scene_node;
-	struct stage_view *view;
+/*
+ * Occluded surfaces.
+ *
+ * The scene sends frame done only to surfaces some output shows, so a
+ * window fully covered by opaque ones above it gets none and its client
+ * stops drawing.  With -o such surfaces are paced by a timer at the
+ * given rate instead.  Once any part of one is uncovered it gets an
+ * output again and is back to the output's rate on the next frame.
+ */
+struct stage_occluded {
+	struct timespec now;
+	int count;
+};
 
-	xdg_surface = wlr_xdg_surface_try_from_wlr_surface(surface);
-	if (xdg_surface == NULL)
-		return (NULL);
+static void
+occluded_frame_done(struct wlr_scene_buffer *buffer, int sx, int sy,
+    void *data)
+{
+	struct wlr_scene_surface *scene_surface;
+	struct stage_occluded *occ;
 
-	scene_node = xdg_surface->data;
+	occ = data;
 
-	view = scene_node->data;
+	if (buffer->primary_output != NULL)
+		return;
 
-	assert(view != NULL);
+	scene_surface = wlr_scene_surface_try_from_buffer(buffer);
+	if (scene_surface == NULL ||
+	    wl_list_empty(&scene_surface->surface->current.frame_callback_list))
+		return;
 
-	return (view);
+	wlr_surface_send_frame_done(scene_surface->surface, &occ->now);
+	occ->count++;
 }
 
 static void
-socket_send(char *str)
+occluded_arm(struct stage_server *server)
 {
-	struct sockaddr_un addr;
-	char send_msg[16];
-	int fd;
 
-	if ((fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0)
+	if (server->occluded_source == NULL || server->occluded_armed)
 		return;
 
-	memset(&addr, 0, sizeof(addr));
-	addr.sun_family = AF_UNIX;
-	strcpy(addr.sun_path, SERVER_SOCK_FILE);
+	wl_event_source_timer_update(server->occluded_source,
+	    1000 / server->occluded_rate);
+	server->occluded_armed = true;
+}
+
+/*
+ * Hidden workspaces are disabled in the scene and not walked.  The timer
+ * stays armed while an occluded surface keeps asking for frames, and
+ * lapses otherwise until an output frame finds one waiting again.
+ */
+static int
+occluded_timer(void *data)
+{
+	struct stage_server *server;
+	struct stage_occluded occ;
 
-	sprintf(send_msg, "%s", str);
+	server = data;
+	server->occluded_armed = false;
 
-	sendto(fd, send_msg, strlen(send_msg) + 1, 0, (struct sockaddr *)&addr,
-	   sizeof(struct sockaddr_un));
+	clock_gettime(CLOCK_MONOTONIC, &occ.now);
+	occ.count = 0;
 
-	close(fd);
+	wlr_scene_node_for_each_buffer(
+	    &server->layer_trees[STAGE_LAYER_TOPLEVEL]->node,
+	    occluded_frame_done, &occ);
+
+	if (occ.count > 0)
+		occluded_arm(server);
+
+	return (0);
+}
+
+/*
+ * Frame done with rate caps.  Same walk as
+ * wlr_scene_output_send_frame_done(), except that a view under a rate
+ * rule is held until its interval has passed; all its surfaces together,
+ * decided once per output frame.  If any is held, the output is woken
+ * up when the first one comes due, as nothing else might damage it.
+ * With -o it also counts occluded view surfaces waiting for a frame.
+ */
+struct stage_frame_done {
+	struct wlr_scene_output *scene_output;
+	struct timespec now;
+	int64_t now_msec;
+	int64_t next;			/* msec to the first due, -1: none. */
+	uint32_t seq;
+	bool occluded_check;
+	int occluded;
+};
+
+static int
+view_frame_interval(struct stage_view *view)
+{
+	const struct stage_rate_rule *rule;
+	int rate;
+
+	rule = view->rate_rule;
+	if (rule == NULL)
+		return (0);
+
+	rate = rule->rate;
+	if (!view->xdg_toplevel->current.activated &&
+	    rule->unfocused_rate > 0)
+		rate = rule->unfocused_rate;
+
+	return (rate > 0 ? 1000 / rate : 0);
 }
 
 static void
-notify_ws_change(int oldws, int newws)
+frame_done_iter(struct wlr_scene_buffer *buffer, int sx, int sy, void *data)
 {
-	struct stage_workspace *ws;
-	char str[256];
-	char *cur;
-	int error;
-	int count;
-	int i;
+	struct wlr_scene_surface *scene_surface;
+	struct stage_frame_done *fd;
+	struct stage_view *view;
+	int64_t due;
+	int interval;
 
-	memset(str, 0, 256);
+	fd = data;
 
-	str[0] = 'W';
+	scene_surface = wlr_scene_surface_try_from_buffer(buffer);
+	if (scene_surface == NULL)
+		return;
 
-	cur = str + 1;
+	if (buffer->primary_output == NULL) {
+		if (fd->occluded_check && !wl_list_empty(
+		    &scene_surface->surface->current.frame_callback_list) &&
+		    view_from_node(&buffer->node) != NULL)
+			fd->occluded++;
+		return;
+	}
 
-	/* Start from workspace 1. End with workspace 0. */
-	i = 1;
-	do {
-		if (i == N_WORKSPACES)
-			i = 0;
+	if (buffer->primary_output != fd->scene_output)
+		return;
 
-		ws = &workspaces[i];
-		if (i == newws) {
-			snprintf(cur, 3, "!%c", ws->name);
-			cur += 2;
-		}
-#if 1
-		else if (!wl_list_empty(&ws->views)) {
-			if (i == oldws) {
-				snprintf(cur, 3, "?%c", ws->name);
-				cur += 2;
-			} else {
-				snprintf(cur, 2, "%c", ws->name);
-				cur += 1;
-			}
+	view = view_from_node(&buffer->node);
+	if (view != NULL && (interval = view_frame_interval(view)) > 0) {
+		if (view->frame_seq != fd->seq) {
+			view->frame_seq = fd->seq;
+			due = view->frame_msec + interval;
+			view->frame_held = fd->now_msec < due;
+			if (!view->frame_held)
+				view->frame_msec = fd->now_msec;
+			else if (fd->next < 0 || due - fd->now_msec < fd->next)
+				fd->next = due - fd->now_msec;
 		}
-#endif
-
-	} while (i++);
+		if (view->frame_held)
+			return;
+	}
 
-	socket_send(str);
+	wlr_surface_send_frame_done(scene_surface->surface, &fd->now);
 }
 
-static void
-changeworkspace(struct stage_server *server, int newws)
+/* Returns the number of occluded surfaces waiting for a frame. */
+static int
+output_send_frame_done(struct stage_output *output,
+    struct wlr_scene_output *scene_output, struct timespec *now)
 {
-	struct stage_workspace *ws;
-	struct stage_view *view, *tmpview;
-	struct stage_view *focused_view;
-	struct stage_output *out;
-	struct wlr_surface *surface;
-	struct wlr_seat *seat;
-	int oldws;
+	struct stage_frame_done fd;
 
-	out = cursor_at(server);
-	if (out->curws == newws)
-		return;
+	fd.scene_output = scene_output;
+	fd.occluded_check = output->server->occluded_source != NULL;
+	fd.occluded = 0;
+	fd.now = *now;
+	fd.now_msec = (int64_t)now->tv_sec * 1000 + now->tv_nsec / 1000000;
+	fd.next = -1;
+	fd.seq = ++output->server->frame_seq;
 
-	oldws = out->curws;
-	server->oldws = oldws;
-	out->curws = newws;
+	wlr_scene_node_for_each_buffer(&output->server->scene->tree.node,
+	    frame_done_iter, &fd);
 
-	focused_view = NULL;
-	seat = server->seat;
-	surface = seat->keyboard_state.focused_surface;
-	if (surface)
-		focused_view = view_from_surface(server, surface);
+	if (fd.next >= 0)
+		wl_event_source_timer_update(output->frame_timer,
+		    fd.next > 0 ? fd.next : 1);
 
-	dprintf("%s: ws %d -> %d\n", __func__, oldws, newws);
+	return (fd.occluded);
+}
 
-	ws = &workspaces[oldws];
-	wl_list_for_each_safe(view, tmpview, &ws->views, link) {
-		wlr_scene_node_set_enabled(&view->scene_tree->node, false);
-		if (view == focused_view)
-			view->was_focused = true;
-		else
-			view->was_focused = false;
-	}
+static int
+output_frame_timer(void *data)
+{
+	struct stage_output *output;
 
-	ws = &workspaces[newws];
-	wl_list_for_each_safe(view, tmpview, &ws->views, link) {
-		wlr_scene_node_set_enabled(&view->scene_tree->node, true);
-		if (view->was_focused)
-			focus_view(view, view_surface(view));
-	}
+	output = data;
 
-	cursor_focus(server, 0);
-	notify_ws_change(oldws, newws);
+	wlr_output_schedule_frame(output->wlr_output);
+
+	return (0);
 }
 
 static void
 output_frame(struct wl_listener *listener, void *data)
 {
 	struct wlr_scene_output *scene_output;
+	struct stage_server *server;
 	struct wlr_scene *scene;
 	struct stage_output *output;
 	struct timespec now;
@@ -1072,13 +2501,21 @@ output_frame(struct wl_listener *listener, void *data)
 	dprintf("%s\n", __func__);
 
 	output = wl_container_of(listener, output, frame);
+	server = output->server;
+
+	/* Before frame done, so clients drawing on it see the new position. */
+	state_cursor_publish(output->server);
 
 	scene = output->server->scene;
 	scene_output = wlr_scene_get_scene_output(scene, output->wlr_output);
 	wlr_scene_output_commit(scene_output, NULL);
 
 	clock_gettime(CLOCK_MONOTONIC, &now);
-	wlr_scene_output_send_frame_done(scene_output, &now);
+	if (server->nrated > 0 || server->occluded_source != NULL) {
+		if (output_send_frame_done(output, scene_output, &now) > 0)
+			occluded_arm(server);
+	} else
+		wlr_scene_output_send_frame_done(scene_output, &now);
 }
 
 static void
@@ -1149,6 +2586,8 @@ switch_layout(struct stage_server *server, int layout)
 	    kbd->modifiers.latched, kbd->modifiers.locked, layout);
 
 	server->current_layout = layout;
+
+	notify_state_change(server);
 }
 
 static void
@@ -1569,12 +3008,12 @@ server_new_input(struct wl_listener *listener, void *data)
 }
 
 static void
-init_slots(struct wlr_output *wlr_output)
+init_slots(struct wlr_box *area)
 {
 	int i, w, h, tw;
 
-	w = wlr_output->width;
-	h = wlr_output->height;
+	w = area->width;
+	h = area->height;
 
 	tw = TERMINAL_FONT_WIDTH * 80 + 4;
 
@@ -1602,7 +3041,12 @@ init_slots(struct wlr_output *wlr_output)
 	slots[4].h = h;
 	slots[4].flags = 0;
 
-	nslots += 5;
+	for (i = 0; i < N_SLOTS; i++) {
+		slots[i].x += area->x;
+		slots[i].y += area->y;
+	}
+
+	nslots = N_SLOTS;
 }
 
 static void
@@ -1620,17 +3064,85 @@ output_request_state(struct wl_listener *listener, void *data)
 	wlr_output_commit_state(output->wlr_output, event->state);
 }
 
+static void
+output_bind(struct wl_listener *listener, void *data)
+{
+	struct wlr_output_event_bind *event;
+	struct stage_output *output;
+
+	output = wl_container_of(listener, output, bind);
+
+	event = data;
+
+	ext_workspace_output_bind(output->server, output, event->resource);
+}
+
+/*
+ * Give the output a subtree in each scene layer.  Toplevels move
+ * between outputs freely, so they stay in the shared toplevel layer.
+ */
+static void
+output_create_layers(struct stage_server *server, struct stage_output *out)
+{
+	int i;
+
+	for (i = 0; i < STAGE_NLAYERS; i++) {
+		out->layer_trees[i] = NULL;
+		if (i == STAGE_LAYER_TOPLEVEL)
+			continue;
+		out->layer_trees[i] =
+		    wlr_scene_tree_create(server->layer_trees[i]);
+	}
+
+	/* Sized by arrange_layers(). */
+	out->lock_rect = wlr_scene_rect_create(
+	    out->layer_trees[STAGE_LAYER_LOCK], 0, 0, color_lock);
+	out->lock_surface = NULL;
+	out->lock_scene = NULL;
+}
+
 static void
 output_destroy(struct wl_listener *listener, void *data)
 {
-	const struct wlr_output_event_destroy *event;
+	struct stage_layer_surface *surface, *tmp;
+	struct stage_server *server;
 	struct stage_output *output;
+	int i;
 
 	printf("%s\n", __func__);
 
 	output = wl_container_of(listener, output, destroy);
+	server = output->server;
 
-	event = data;
+	ext_workspace_output_remove(server, output);
+
+	/* Layer surfaces are bound to their output: close them. */
+	wl_list_for_each_safe(surface, tmp, &output->layers, link) {
+		surface->output = NULL;
+		wl_list_remove(&surface->link);
+		wl_list_init(&surface->link);
+		wlr_layer_surface_v1_destroy(surface->layer_surface);
+	}
+
+	/* The indicator and lock surfaces go with the subtrees. */
+	for (i = 0; i < STAGE_NLAYERS; i++)
+		if (output->layer_trees[i] != NULL)
+			wlr_scene_node_destroy(&output->layer_trees[i]->node);
+
+	wl_event_source_remove(output->frame_timer);
+	wl_list_remove(&output->frame.link);
+	wl_list_remove(&output->request_state.link);
+	wl_list_remove(&output->destroy.link);
+	wl_list_remove(&output->bind.link);
+	wl_list_remove(&output->link);
+	free(output);
+
+	/* The slots may have gone with it: take them from the new owner. */
+	output = slots_output(server);
+	if (output != NULL && !wlr_box_empty(&output->usable_area))
+		init_slots(&output->usable_area);
+
+	notify_state_change(server);
 }
 
 static void
@@ -1678,11 +3190,18 @@ server_new_output(struct wl_listener *listener, void *data)
 
 	output = malloc(sizeof(struct stage_output));
 	output->curws = 0; /* TODO */
+	wl_list_init(&output->layers);
+	memset(&output->usable_area, 0, sizeof(struct wlr_box));
+	output_create_layers(server, output);
+	output->indicator = NULL;
 	output->wlr_output = wlr_output;
 	wlr_output->data = output;
 	output->server = server;
 	output->frame.notify = output_frame;
 	wl_signal_add(&wlr_output->events.frame, &output->frame);
+	output->frame_timer = wl_event_loop_add_timer(
+	    wl_display_get_event_loop(server->wl_disp), output_frame_timer,
+	    output);
 	wl_list_insert(&server->outputs, &output->link);
 
 	output->destroy.notify = output_destroy;
@@ -1692,13 +3211,19 @@ server_new_output(struct wl_listener *listener, void *data)
 	wl_signal_add(&wlr_output->events.request_state,
 	    &output->request_state);
 
+	output->bind.notify = output_bind;
+	wl_signal_add(&wlr_output->events.bind, &output->bind);
+
 	l_output = wlr_output_layout_add_auto(server->output_layout,
 	    wlr_output);
 	scene_output = wlr_scene_output_create(server->scene, wlr_output);
 	wlr_scene_output_layout_add_output(server->scene_layout, l_output,
 	    scene_output);
 
-	init_slots(wlr_output);
+	arrange_layers(output);
+
+	ext_workspace_output_add(server, output);
+	notify_state_change(server);
 }
 
 static void
@@ -1709,6 +3234,8 @@ xdg_toplevel_unmap(struct wl_listener *listener, void *data)
 	view = wl_container_of(listener, view, unmap);
 
 	wl_list_remove(&view->link);
+
+	notify_state_change(view->server);
 }
 
 static void
@@ -1735,6 +3262,14 @@ xdg_toplevel_destroy(struct wl_listener *listener, void *data)
 	wl_list_remove(&view->request_resize.link);
 	wl_list_remove(&view->set_app_id.link);
 
+	if (view->decoration != NULL) {
+		wl_list_remove(&view->decoration_request_mode.link);
+		wl_list_remove(&view->decoration_destroy.link);
+	}
+
+	if (view->rate_rule != NULL)
+		view->server->nrated--;
+
 	free(view);
 }
 
@@ -1748,6 +3283,30 @@ xdg_toplevel_request_resize(struct wl_listener *listener, void *data)
 	view = wl_container_of(listener, view, request_resize);
 }
 
+static void
+view_set_rate_rule(struct stage_view *view)
+{
+	const struct stage_rate_rule *rule;
+	const char *app_id;
+	size_t i;
+
+	rule = NULL;
+
+	app_id = get_app_id(view);
+	for (i = 0; app_id != NULL && rate_rules[i].app_id != NULL; i++)
+		if (strcmp(app_id, rate_rules[i].app_id) == 0) {
+			rule = &rate_rules[i];
+			break;
+		}
+
+	if (view->rate_rule != NULL)
+		view->server->nrated--;
+	if (rule != NULL)
+		view->server->nrated++;
+
+	view->rate_rule = rule;
+}
+
 static void
 handle_set_app_id(struct wl_listener *listener, void *data)
 {
@@ -1759,6 +3318,24 @@ handle_set_app_id(struct wl_listener *listener, void *data)
 	app_id = view->xdg_toplevel->app_id;
 
 	view_set_slot(view);
+	view_set_rate_rule(view);
+}
+
+/*
+ * stage draws the borders: always answer server side, so clients render
+ * content only, without shadows or title bars.  The mode goes out with
+ * a configure, which a toplevel can only get once it is initialized.
+ */
+static void
+view_set_decoration_mode(struct stage_view *view)
+{
+
+	if (view->decoration == NULL ||
+	    !view->xdg_toplevel->base->initialized)
+		return;
+
+	wlr_xdg_toplevel_decoration_v1_set_mode(view->decoration,
+	    WLR_XDG_TOPLEVEL_DECORATION_V1_MODE_SERVER_SIDE);
 }
 
 static void
@@ -1767,8 +3344,12 @@ xdg_toplevel_commit(struct wl_listener *listener, void *data)
 	struct stage_view *toplevel;
 
 	toplevel = wl_container_of(listener, toplevel, commit);
-	if (toplevel->xdg_toplevel->base->initial_commit)
+	if (toplevel->xdg_toplevel->base->initial_commit) {
 		wlr_xdg_toplevel_set_size(toplevel->xdg_toplevel, 0, 0);
+		view_set_decoration_mode(toplevel);
+	}
+
+	view_update_backdrop(toplevel);
 }
 
 static void
@@ -1793,7 +3374,7 @@ server_new_xdg_surface(struct wl_listener *listener, void *data)
 	view->server = server;
 	view->xdg_toplevel = xdg_toplevel;
 	view->scene_tree = wlr_scene_xdg_surface_create(
-	    &view->server->scene->tree, xdg_toplevel->base);
+	    server->layer_trees[STAGE_LAYER_TOPLEVEL], xdg_toplevel->base);
 	view->scene_tree->node.data = view;
 	xdg_toplevel->base->data = view->scene_tree;
 
@@ -2043,6 +3624,8 @@ process_cursor_motion(struct stage_server *server, uint32_t time)
 
 	dprintf("%s: mode %d\n", __func__, server->cursor_mode);
 
+	state_cursor_moved(server);
+
 	switch (server->cursor_mode) {
 	case STAGE_CURSOR_MOVE:
 		process_cursor_move(server, time);
@@ -2256,16 +3839,58 @@ handle_server_decoration(struct wl_listener *listener, void *data)
 	printf("%s\n", __func__);
 
 	wlr_deco = data;
-};
+}
+
+static void
+xdg_decoration_request_mode(struct wl_listener *listener, void *data)
+{
+	struct stage_view *view;
+
+	view = wl_container_of(listener, view, decoration_request_mode);
+
+	view_set_decoration_mode(view);
+}
+
+static void
+xdg_decoration_destroy(struct wl_listener *listener, void *data)
+{
+	struct stage_view *view;
+
+	view = wl_container_of(listener, view, decoration_destroy);
+
+	wl_list_remove(&view->decoration_request_mode.link);
+	wl_list_remove(&view->decoration_destroy.link);
+	view->decoration = NULL;
+}
 
 static void
 handle_xdg_decoration(struct wl_listener *listener, void *data)
 {
 	struct wlr_xdg_toplevel_decoration_v1 *wlr_deco;
+	struct wlr_scene_tree *scene_tree;
+	struct stage_view *view;
 
 	printf("%s\n", __func__);
 
 	wlr_deco = data;
+
+	scene_tree = wlr_deco->toplevel->base->data;
+	if (scene_tree == NULL)
+		return;
+	view = scene_tree->node.data;
+	if (view == NULL || view->decoration != NULL)
+		return;
+
+	view->decoration = wlr_deco;
+
+	view->decoration_request_mode.notify = xdg_decoration_request_mode;
+	wl_signal_add(&wlr_deco->events.request_mode,
+	    &view->decoration_request_mode);
+
+	view->decoration_destroy.notify = xdg_decoration_destroy;
+	wl_signal_add(&wlr_deco->events.destroy, &view->decoration_destroy);
+
+	view_set_decoration_mode(view);
 }
 
 static void
@@ -2286,9 +3911,33 @@ main(int argc, char *argv[])
 	struct stage_server server;
 	struct sigaction act;
 	const char *socket;
+	bool indicator;
+	int occluded_rate;
 	int error;
+	int c;
 	int i;
 
+	indicator = false;
+	occluded_rate = 0;
+	while ((c = getopt(argc, argv, "io:")) != -1) {
+		switch (c) {
+		case 'i':
+			indicator = true;
+			break;
+		case 'o':
+			occluded_rate = atoi(optarg);
+			if (occluded_rate < 0 || occluded_rate > 1000) {
+				fprintf(stderr, "%s: bad rate %s\n", argv[0],
+				    optarg);
+				return (1);
+			}
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-i] [-o hz]\n", argv[0]);
+			return (1);
+		}
+	}
+
 	sigemptyset(&act.sa_mask);
 	act.sa_flags = 0;
 	act.sa_handler = sig_chld;
@@ -2298,11 +3947,16 @@ main(int argc, char *argv[])
 	wlr_log_init(WLR_DEBUG, NULL);
 
 	memset(&server, 0, sizeof(struct stage_server));
+	server.indicator = indicator;
+	server.occluded_rate = occluded_rate;
 
 	server.wl_disp = wl_display_create();
 
 	loop = wl_display_get_event_loop(server.wl_disp);
 	server.backend = wlr_backend_autocreate(loop, 0);
+	if (occluded_rate > 0)
+		server.occluded_source = wl_event_loop_add_timer(loop,
+		    occluded_timer, &server);
 	server.renderer = wlr_renderer_autocreate(server.backend);
 	wlr_renderer_init_wl_display(server.renderer, server.wl_disp);
 
@@ -2321,6 +3975,8 @@ main(int argc, char *argv[])
 	wlr_gamma_control_manager_v1_create(server.wl_disp);
 	wlr_primary_selection_v1_device_manager_create(server.wl_disp);
 	wlr_viewporter_create(server.wl_disp);
+	wlr_single_pixel_buffer_manager_v1_create(server.wl_disp);
+	wlr_fractional_scale_manager_v1_create(server.wl_disp, 1);
 	wlr_subcompositor_create(server.wl_disp);
 
 	server.activation = wlr_xdg_activation_v1_create(server.wl_disp);
@@ -2342,12 +3998,14 @@ main(int argc, char *argv[])
 	server.scene_layout = wlr_scene_attach_output_layout(server.scene,
 	    server.output_layout);
 
-#if 0
-	struct wlr_scene_tree *tree;
-	tree = wlr_scene_tree_create(&server.scene->tree);
-#endif
+	for (i = 0; i < STAGE_NLAYERS; i++)
+		server.layer_trees[i] =
+		    wlr_scene_tree_create(&server.scene->tree);
+	wlr_scene_node_set_enabled(&server.layer_trees[STAGE_LAYER_LOCK]->node,
+	    false);
 
-	server.xdg_shell = wlr_xdg_shell_create(server.wl_disp, 3);
+	/* Version 6 for the suspended state. */
+	server.xdg_shell = wlr_xdg_shell_create(server.wl_disp, 6);
 	server.new_xdg_surface.notify = server_new_xdg_surface;
 	wl_signal_add(&server.xdg_shell->events.new_toplevel,
 	    &server.new_xdg_surface);
@@ -2441,6 +4099,11 @@ main(int argc, char *argv[])
 	server.new_lock.notify = new_lock;
 	wl_signal_add(&server.lock->events.new_lock, &server.new_lock);
 
+	wl_list_init(&server.ext_ws_clients);
+	server.ext_ws_global = wl_global_create(server.wl_disp,
+	    &ext_workspace_manager_v1_interface, EXT_WS_VERSION, &server,
+	    ext_ws_bind);
+
 	server.shell = wlr_layer_shell_v1_create(server.wl_disp, 4);
 	server.new_layer_shell_surface.notify = new_layer_shell_surface;
 	wl_signal_add(&server.shell->events.new_surface,
@@ -2452,6 +4115,9 @@ main(int argc, char *argv[])
 	server.idle = wlr_idle_create(server.wl_disp);
 #endif
 
+	if (state_init(&server) == 0)
+		state_publish(&server);
+
 	socket = wl_display_add_socket_auto(server.wl_disp);
 	if (socket == NULL) {
 		wlr_backend_destroy(server.backend);
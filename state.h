@@ -0,0 +1,215 @@
+/*-
+ * Copyright (c) 2026 Ruslan Bukin <br@bsdpad.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Shared state page published by stage.
+ *
+ * The page lives in a memfd that stage hands out over STATE_SOCK_FILE:
+ * connect to the socket and receive the descriptor with SCM_RIGHTS.
+ * Readers map it read-only and use the seqlock below; seq is also the
+ * generation counter, so a reader can futex-wait on it for changes.
+ *
+ * The cursor position has its own slot and seqlock, written at most once
+ * per output frame and only when the integer position changed.  Readers
+ * can futex-wait on cursor_seq for the pointer to move.
+ */
+
+#ifndef _STATE_H_
+#define _STATE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <limits.h>
+#include <unistd.h>
+#elif defined(__FreeBSD__)
+#include <sys/types.h>
+#include <sys/umtx.h>
+#include <limits.h>
+#endif
+
+#define	STATE_SOCK_FILE		"/tmp/stage-state.sock"
+#define	STATE_MAGIC		0x53544745	/* STGE */
+#define	STATE_VERSION		2
+
+#define	STATE_MAX_OUTPUTS	8
+#define	STATE_MAX_WORKSPACES	16
+#define	STATE_OUTPUT_NAME_LEN	32
+#define	STATE_APP_ID_LEN	64
+
+struct stage_state_output {
+	char name[STATE_OUTPUT_NAME_LEN];
+	uint32_t curws;
+};
+
+struct stage_state {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq;		/* Odd while stage is updating the page. */
+	uint32_t noutputs;
+	uint32_t oldws;
+	uint32_t occupied;	/* Bitmask of non-empty workspaces. */
+	uint32_t layout;	/* Keyboard layout index. */
+	char ws_names[STATE_MAX_WORKSPACES];
+	char app_id[STATE_APP_ID_LEN];
+	struct stage_state_output outputs[STATE_MAX_OUTPUTS];
+	uint32_t cursor_seq;	/* Odd while the cursor slot is updated. */
+	int32_t cursor_x;	/* Layout coordinates. */
+	int32_t cursor_y;
+};
+
+/* Writer side, stage only. */
+
+static inline void
+state_write_begin(struct stage_state *st)
+{
+
+	__atomic_store_n(&st->seq, st->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void
+state_write_end(struct stage_state *st)
+{
+
+	__atomic_store_n(&st->seq, st->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline void
+state_wake(struct stage_state *st)
+{
+
+#if defined(__linux__)
+	syscall(SYS_futex, &st->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#elif defined(__FreeBSD__)
+	_umtx_op(&st->seq, UMTX_OP_WAKE, INT_MAX, NULL, NULL);
+#endif
+}
+
+static inline void
+state_cursor_write(struct stage_state *st, int32_t x, int32_t y)
+{
+
+	__atomic_store_n(&st->cursor_seq, st->cursor_seq + 1,
+	    __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&st->cursor_x, x, __ATOMIC_RELAXED);
+	__atomic_store_n(&st->cursor_y, y, __ATOMIC_RELAXED);
+	__atomic_store_n(&st->cursor_seq, st->cursor_seq + 1,
+	    __ATOMIC_RELEASE);
+}
+
+static inline void
+state_cursor_wake(struct stage_state *st)
+{
+
+#if defined(__linux__)
+	syscall(SYS_futex, &st->cursor_seq, FUTEX_WAKE, INT_MAX, NULL, NULL,
+	    0);
+#elif defined(__FreeBSD__)
+	_umtx_op(&st->cursor_seq, UMTX_OP_WAKE, INT_MAX, NULL, NULL);
+#endif
+}
+
+/* Reader side. */
+
+static inline uint32_t
+state_read_begin(const struct stage_state *st)
+{
+	uint32_t seq;
+
+	while ((seq = __atomic_load_n(&st->seq, __ATOMIC_ACQUIRE)) & 1)
+		;
+
+	return (seq);
+}
+
+static inline int
+state_read_retry(const struct stage_state *st, uint32_t seq)
+{
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return (__atomic_load_n(&st->seq, __ATOMIC_RELAXED) != seq);
+}
+
+static inline void
+state_read(const struct stage_state *st, struct stage_state *copy)
+{
+	uint32_t seq;
+
+	do {
+		seq = state_read_begin(st);
+		memcpy(copy, st, sizeof(struct stage_state));
+	} while (state_read_retry(st, seq));
+}
+
+/* Returns the cursor slot generation the position was read at. */
+static inline uint32_t
+state_cursor_read(const struct stage_state *st, int32_t *x, int32_t *y)
+{
+	uint32_t seq;
+
+	do {
+		while ((seq = __atomic_load_n(&st->cursor_seq,
+		    __ATOMIC_ACQUIRE)) & 1)
+			;
+		*x = __atomic_load_n(&st->cursor_x, __ATOMIC_RELAXED);
+		*y = __atomic_load_n(&st->cursor_y, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&st->cursor_seq, __ATOMIC_RELAXED) != seq);
+
+	return (seq);
+}
+
+/* Sleep until the generation counter moves away from seq. */
+static inline void
+state_wait(const struct stage_state *st, uint32_t seq)
+{
+
+#if defined(__linux__)
+	syscall(SYS_futex, &st->seq, FUTEX_WAIT, seq, NULL, NULL, 0);
+#elif defined(__FreeBSD__)
+	_umtx_op((void *)&st->seq, UMTX_OP_WAIT_UINT, seq, NULL, NULL);
+#endif
+}
+
+/* Sleep until the cursor slot generation moves away from seq. */
+static inline void
+state_cursor_wait(const struct stage_state *st, uint32_t seq)
+{
+
+#if defined(__linux__)
+	syscall(SYS_futex, &st->cursor_seq, FUTEX_WAIT, seq, NULL, NULL, 0);
+#elif defined(__FreeBSD__)
+	_umtx_op((void *)&st->cursor_seq, UMTX_OP_WAIT_UINT, seq, NULL,
+	    NULL);
+#endif
+}
+
+#endif /* !_STATE_H_ */
@@ -0,0 +1,525 @@
+/*-
+ * Copyright (c) 2026 Ruslan Bukin <br@bsdpad.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * ws-bench: drive the bar's drawing paths in-process, against offscreen
+ * panel buffers, and report what each update costs.
+ *
+ * Every case renders a panel the way ws does: pick a back buffer, draw
+ * the changed cells, hand the buffer over.  The "compositor" releases a
+ * buffer as soon as the next one is committed, so copy-forward of stale
+ * regions is exercised too.  Per update it reports latency percentiles,
+ * heap allocations (malloc is interposed) and the bytes damaged.
+ */
+
+#define	_GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pixman.h>
+#include <fcft/fcft.h>
+
+#include "wlr-layer-shell-unstable-v1-client-protocol.h"
+#include "ext-workspace-v1-client-protocol.h"
+#include "image.h"
+#include "state.h"
+
+#define	BENCH_ITERATIONS	10000
+#define	BENCH_HEIGHT		2160
+#define	BENCH_NAMES		"1234567890-=\\`ts"	/* Strip order. */
+#define	BENCH_NWS		16
+
+/*
+ * Allocation counting.  dlsym() may itself call calloc() before the real
+ * one is known, that one is served from a small static arena.
+ */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static uint64_t nallocs;
+static bool resolving;
+
+static char boot_heap[4096];
+static size_t boot_used;
+
+static void
+bench_resolve(void)
+{
+
+	resolving = true;
+	real_malloc = dlsym(RTLD_NEXT, "malloc");
+	real_calloc = dlsym(RTLD_NEXT, "calloc");
+	real_realloc = dlsym(RTLD_NEXT, "realloc");
+	real_free = dlsym(RTLD_NEXT, "free");
+	resolving = false;
+}
+
+static bool
+boot_owned(void *ptr)
+{
+
+	return ((char *)ptr >= boot_heap &&
+	    (char *)ptr < boot_heap + sizeof(boot_heap));
+}
+
+void *
+malloc(size_t size)
+{
+
+	if (real_malloc == NULL)
+		bench_resolve();
+	nallocs++;
+
+	return (real_malloc(size));
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+	void *ptr;
+
+	if (real_calloc == NULL) {
+		if (resolving) {
+			size = (n * size + 15) & ~(size_t)15;
+			if (boot_used + size > sizeof(boot_heap))
+				return (NULL);
+			ptr = boot_heap + boot_used;
+			boot_used += size;
+			return (ptr);
+		}
+		bench_resolve();
+	}
+	nallocs++;
+
+	return (real_calloc(n, size));
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+
+	if (real_realloc == NULL)
+		bench_resolve();
+	nallocs++;
+
+	return (real_realloc(ptr, size));
+}
+
+void
+free(void *ptr)
+{
+
+	if (ptr == NULL || boot_owned(ptr))
+		return;
+	if (real_free == NULL)
+		bench_resolve();
+
+	real_free(ptr);
+}
+
+/* workspace.c calls back into the event loop, which is not here. */
+void
+ws_schedule(struct ws *app)
+{
+
+}
+
+struct bench {
+	const char *name;
+	struct ws_panel *panel;
+	struct ws_buffer *shown;	/* Held by the "compositor". */
+	uint64_t *ns;
+	uint64_t allocs;
+	uint64_t damaged;
+	int n;
+};
+
+static uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/* What ws_panel_flush() does, minus the protocol: account and commit. */
+static void
+bench_commit(struct bench *b)
+{
+	struct ws_image *image;
+	struct ws_buffer *buf;
+	pixman_box32_t *rects;
+	int nrects;
+	int i;
+
+	image = b->panel->image;
+
+	rects = pixman_region32_rectangles(&image->damage, &nrects);
+	for (i = 0; i < nrects; i++)
+		b->damaged += (uint64_t)(rects[i].x2 - rects[i].x1) *
+		    (rects[i].y2 - rects[i].y1) * 4;
+
+	buf = ws_image_end(image);
+	if (buf == NULL)
+		return;
+
+	if (b->shown != NULL && b->shown != buf)
+		b->shown->busy = false;
+	b->shown = buf;
+}
+
+static int
+bench_cmp(const void *a, const void *b)
+{
+	uint64_t x, y;
+
+	x = *(const uint64_t *)a;
+	y = *(const uint64_t *)b;
+
+	return ((x > y) - (x < y));
+}
+
+static double
+bench_pct(struct bench *b, int pct)
+{
+	int i;
+
+	i = (b->n - 1) * pct / 100;
+
+	return (b->ns[i] / 1000.0);
+}
+
+static void
+bench_report(struct bench *b)
+{
+
+	qsort(b->ns, b->n, sizeof(uint64_t), bench_cmp);
+
+	printf("%-10s n %d  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f us  "
+	    "allocs %.2f  damaged %llu bytes/update\n", b->name, b->n,
+	    bench_pct(b, 50), bench_pct(b, 90), bench_pct(b, 99),
+	    bench_pct(b, 100), (double)b->allocs / b->n,
+	    (unsigned long long)(b->damaged / b->n));
+}
+
+static void
+bench_init(struct bench *b, const char *name, struct ws_panel *panel,
+    int n)
+{
+
+	memset(b, 0, sizeof(struct bench));
+	b->name = name;
+	b->panel = panel;
+	b->n = n;
+	b->ns = calloc(n, sizeof(uint64_t));
+	if (b->ns == NULL) {
+		printf("calloc failed\n");
+		exit(1);
+	}
+}
+
+static void
+bench_fini(struct bench *b)
+{
+
+	bench_report(b);
+	free(b->ns);
+}
+
+/* A cheap deterministic sequence, so runs are comparable. */
+static uint32_t
+bench_rand(uint32_t *seed)
+{
+
+	*seed = *seed * 1103515245 + 12345;
+
+	return (*seed >> 16);
+}
+
+/* Synthetic strips: the current and previous workspace move around. */
+static void
+bench_numbers(struct ws_panel *panel, int n)
+{
+	char strip[WS_STRIP_LEN];
+	uint32_t occupied;
+	uint32_t seed;
+	struct bench b;
+	uint64_t start;
+	int cur, prev;
+	char *p;
+	int i, j;
+
+	bench_init(&b, "numbers", panel, n);
+
+	seed = 1;
+	prev = 0;
+	for (i = 0; i < n; i++) {
+		cur = bench_rand(&seed) % BENCH_NWS;
+		occupied = bench_rand(&seed) | (1 << cur) | (1 << prev);
+
+		p = strip;
+		for (j = 0; j < BENCH_NWS; j++) {
+			if ((occupied & (1 << j)) == 0)
+				continue;
+			if (j == cur)
+				*p++ = '!';
+			else if (j == prev)
+				*p++ = '?';
+			*p++ = BENCH_NAMES[j];
+		}
+		*p = '\0';
+		prev = cur;
+
+		start = bench_now();
+		b.allocs -= nallocs;
+		draw_numbers(panel, strip);
+		bench_commit(&b);
+		b.allocs += nallocs;
+		b.ns[i] = bench_now() - start;
+	}
+
+	bench_fini(&b);
+}
+
+/* The clock, a minute per update. */
+static void
+bench_time(struct ws_panel *panel, int n)
+{
+	char clock[TEXT_MAX];
+	struct bench b;
+	uint64_t start;
+	int i;
+
+	bench_init(&b, "time", panel, n);
+
+	for (i = 0; i < n; i++) {
+		snprintf(clock, sizeof(clock), "%02d:%02d", (i / 60) % 24,
+		    i % 60);
+
+		start = bench_now();
+		b.allocs -= nallocs;
+		ws_draw_time(panel, clock);
+		bench_commit(&b);
+		b.allocs += nallocs;
+		b.ns[i] = bench_now() - start;
+	}
+
+	bench_fini(&b);
+}
+
+/*
+ * The workspace receive path: ext-workspace state as the listeners leave
+ * it after a done event, turned into the strip and drawn.
+ */
+static void
+bench_workspace(struct ws_panel *panel, int n)
+{
+	struct ws_workspace workspaces[BENCH_NWS];
+	char names[BENCH_NWS][2];
+	char strip[WS_STRIP_LEN];
+	struct ws_output output;
+	struct ws_group group;
+	struct ws_workspace *ws;
+	uint32_t occupied;
+	uint32_t seed;
+	struct bench b;
+	uint64_t start;
+	struct ws app;
+	int cur;
+	int i, j;
+
+	memset(&app, 0, sizeof(struct ws));
+	memset(&group, 0, sizeof(struct ws_group));
+	memset(&output, 0, sizeof(struct ws_output));
+	wl_list_init(&app.groups);
+	wl_list_init(&app.workspaces);
+
+	/* Any pointer will do to pair the group with the output. */
+	group.app = &app;
+	group.wl_output = (struct wl_output *)&output;
+	wl_list_insert(&app.groups, &group.link);
+	output.app = &app;
+	output.wl_output = group.wl_output;
+
+	for (j = 0; j < BENCH_NWS; j++) {
+		ws = &workspaces[j];
+		memset(ws, 0, sizeof(struct ws_workspace));
+		names[j][0] = BENCH_NAMES[j];
+		names[j][1] = '\0';
+		ws->name = names[j];
+		ws->group = &group;
+		wl_list_insert(app.workspaces.prev, &ws->link);
+	}
+
+	bench_init(&b, "workspace", panel, n);
+
+	seed = 2;
+	for (i = 0; i < n; i++) {
+		cur = bench_rand(&seed) % BENCH_NWS;
+		occupied = bench_rand(&seed) | (1 << cur);
+
+		start = bench_now();
+		b.allocs -= nallocs;
+		for (j = 0; j < BENCH_NWS; j++) {
+			ws = &workspaces[j];
+			ws->state = 0;
+			if (j == cur)
+				ws->state |= EXT_WORKSPACE_HANDLE_V1_STATE_ACTIVE;
+			else if ((occupied & (1 << j)) == 0)
+				ws->state |= EXT_WORKSPACE_HANDLE_V1_STATE_HIDDEN;
+		}
+		if (group.active != &workspaces[cur]) {
+			group.previous = group.active;
+			group.active = &workspaces[cur];
+		}
+		ws_workspace_text(&output, strip, sizeof(strip));
+		draw_numbers(panel, strip);
+		bench_commit(&b);
+		b.allocs += nallocs;
+		b.ns[i] = bench_now() - start;
+	}
+
+	bench_fini(&b);
+}
+
+/* The state page receive path: sample the cursor slot, draw the overlay. */
+static void
+bench_cursor(struct ws_panel *panel, int n)
+{
+	struct stage_state page;
+	char xy[TEXT_MAX];
+	uint32_t seed;
+	struct bench b;
+	uint64_t start;
+	int32_t x, y;
+	int i;
+
+	memset(&page, 0, sizeof(struct stage_state));
+	page.magic = STATE_MAGIC;
+	page.version = STATE_VERSION;
+
+	bench_init(&b, "cursor", panel, n);
+
+	seed = 3;
+	for (i = 0; i < n; i++) {
+		state_cursor_write(&page, bench_rand(&seed) % 3840,
+		    bench_rand(&seed) % 2160);
+
+		start = bench_now();
+		b.allocs -= nallocs;
+		state_cursor_read(&page, &x, &y);
+		snprintf(xy, sizeof(xy), "%d,%d", x, y);
+		draw_cursor_xy(panel, xy);
+		bench_commit(&b);
+		b.allocs += nallocs;
+		b.ns[i] = bench_now() - start;
+	}
+
+	bench_fini(&b);
+}
+
+static int
+bench_panel(struct ws_panel *panel)
+{
+	char name[] = "ws-bench";
+
+	panel->image = ws_image_create(name, panel->buf_width,
+	    panel->buf_height);
+	if (panel->image == NULL)
+		return (-1);
+
+	return (0);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct ws_surface surf;
+	int scale;
+	int ch;
+	int n;
+
+	n = BENCH_ITERATIONS;
+	scale = WS_SCALE_BASE;
+
+	while ((ch = getopt(argc, argv, "n:s:")) != -1) {
+		switch (ch) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 's':
+			scale = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: ws-bench [-n iterations] "
+			    "[-s scale/120]\n");
+			return (1);
+		}
+	}
+
+	if (n < 1 || scale < 1) {
+		fprintf(stderr, "ws-bench: bad iterations or scale\n");
+		return (1);
+	}
+
+	fcft_init(FCFT_LOG_COLORIZE_AUTO, false, FCFT_LOG_CLASS_ERROR);
+	ws_atlas_init();
+
+	memset(&surf, 0, sizeof(struct ws_surface));
+	surf.scale = scale;
+	ws_panel_layout(&surf, BENCH_HEIGHT);
+
+	if (bench_panel(&surf.strip) != 0 || bench_panel(&surf.clock) != 0 ||
+	    bench_panel(&surf.cursor) != 0)
+		return (1);
+
+	printf("ws-bench: %d updates per case, scale %d/%d\n", n, scale,
+	    WS_SCALE_BASE);
+
+	bench_numbers(&surf.strip, n);
+	bench_time(&surf.clock, n);
+	bench_workspace(&surf.strip, n);
+	bench_cursor(&surf.cursor, n);
+
+	ws_image_destroy(surf.strip.image);
+	ws_image_destroy(surf.clock.image);
+	ws_image_destroy(surf.cursor.image);
+	ws_atlas_fini();
+	ws_font_fini();
+	fcft_fini();
+
+	return (0);
+}
@@ -0,0 +1,247 @@
+/*-
+ * Copyright (c) 2026 Ruslan Bukin <br@bsdpad.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Cursor coordinates overlay.  stage keeps the pointer position in the
+ * cursor slot of its state page, refreshed at most once per output
+ * frame and only when it changed.  A watcher thread sleeps on the slot
+ * and pokes an eventfd, so the event thread samples it only after the
+ * pointer moved and ws stays idle otherwise.
+ */
+
+#include <sys/types.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pixman.h>
+
+#include "wlr-layer-shell-unstable-v1-client-protocol.h"
+#include "image.h"
+#include "state.h"
+
+static const struct stage_state *state;
+static uint32_t cursor_gen;
+
+static pthread_t watch_thread;
+static bool watching;
+static int moved_fd = -1;
+
+/* Get the state page descriptor from stage. */
+static int
+ws_cursor_connect(void)
+{
+	struct sockaddr_un addr;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+	char c;
+	int sock;
+	int fd;
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return (-1);
+
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, STATE_SOCK_FILE, sizeof(addr.sun_path) - 1);
+
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		printf("connect to %s failed: %s\n", STATE_SOCK_FILE,
+		    strerror(errno));
+		close(sock);
+		return (-1);
+	}
+
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+
+	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof(cbuf.buf);
+
+	fd = -1;
+	if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) > 0) {
+		cmsg = CMSG_FIRSTHDR(&msg);
+		if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	close(sock);
+
+	return (fd);
+}
+
+/*
+ * Wait for stage to move the cursor slot on and tell the event thread.
+ * Cancelled from ws_cursor_fini() while asleep in the futex, hence the
+ * asynchronous cancel type: nothing here holds a lock or allocates.
+ */
+static void *
+ws_cursor_watch(void *arg)
+{
+	uint32_t seen, seq;
+	uint64_t val;
+
+	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+
+	seen = __atomic_load_n(&state->cursor_seq, __ATOMIC_ACQUIRE);
+	for (;;) {
+		state_cursor_wait(state, seen);
+		seq = __atomic_load_n(&state->cursor_seq, __ATOMIC_ACQUIRE);
+		if (seq == seen)
+			continue;
+		seen = seq;
+
+		val = 1;
+		if (write(moved_fd, &val, sizeof(val)) < 0)
+			printf("cursor: eventfd write failed: %s\n",
+			    strerror(errno));
+	}
+
+	return (NULL);
+}
+
+/* Returns the descriptor that turns readable when the pointer moved. */
+int
+ws_cursor_init(void)
+{
+	void *page;
+	int fd;
+
+	fd = ws_cursor_connect();
+	if (fd < 0)
+		return (-1);
+
+	page = mmap(NULL, sizeof(struct stage_state), PROT_READ, MAP_SHARED,
+	    fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		printf("mmap() failed: %s\n", strerror(errno));
+		return (-1);
+	}
+
+	state = page;
+	if (state->magic != STATE_MAGIC || state->version < 2) {
+		printf("Unsupported stage state page\n");
+		munmap(page, sizeof(struct stage_state));
+		state = NULL;
+		return (-1);
+	}
+
+	moved_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (moved_fd < 0) {
+		printf("eventfd failed: %s\n", strerror(errno));
+		ws_cursor_fini();
+		return (-1);
+	}
+
+	if (pthread_create(&watch_thread, NULL, ws_cursor_watch, NULL) != 0) {
+		printf("pthread_create failed\n");
+		ws_cursor_fini();
+		return (-1);
+	}
+	watching = true;
+
+	return (moved_fd);
+}
+
+void
+ws_cursor_fini(void)
+{
+
+	if (watching) {
+		pthread_cancel(watch_thread);
+		pthread_join(watch_thread, NULL);
+		watching = false;
+	}
+
+	if (moved_fd >= 0)
+		close(moved_fd);
+	moved_fd = -1;
+
+	if (state != NULL)
+		munmap((void *)state, sizeof(struct stage_state));
+	state = NULL;
+}
+
+/*
+ * Take a new sample.  Returns true only if the integer position moved,
+ * that is if the overlay needs a redraw.
+ */
+bool
+ws_cursor_sample(struct ws *app)
+{
+	int32_t x, y;
+	uint32_t gen;
+
+	if (state == NULL)
+		return (false);
+
+	if (__atomic_load_n(&state->cursor_seq, __ATOMIC_ACQUIRE) ==
+	    cursor_gen)
+		return (false);
+
+	gen = state_cursor_read(state, &x, &y);
+	cursor_gen = gen;
+
+	if (x == app->cursor_x && y == app->cursor_y)
+		return (false);
+
+	app->cursor_x = x;
+	app->cursor_y = y;
+
+	return (true);
+}
+
+/* Drain the wakeups of the watcher, one sample covers them all. */
+void
+ws_cursor_moved(struct ws *app)
+{
+	uint64_t val;
+
+	if (read(moved_fd, &val, sizeof(val)) < 0)
+		return;
+
+	if (ws_cursor_sample(app))
+		ws_schedule(app);
+}
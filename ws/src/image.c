@@ -27,11 +27,12 @@
 
 #include <errno.h>
 #include <fcntl.h>
-#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
-#include <time.h>
+#include <unistd.h>
 
 #include <pixman.h>
 #include <tllist.h>
@@ -40,8 +41,23 @@
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
 #include "image.h"
 
-static const char *font_list = "ubuntu mono:size=120,xos4 Terminus:size=120";
-static struct fcft_font *font = NULL;
+#define	FONT_LIST		"ubuntu mono"
+#define	FONT_SIZE_LARGE		120
+#define	FONT_SIZE_SMALL		50
+#define	ATLAS_SCALES		4	/* Output scales ws renders at. */
+#define	FONT_CACHE_SIZE		(2 * ATLAS_SCALES)
+
+/*
+ * Font instances, keyed on font list and pixel size.  Every face ws
+ * draws with is loaded once per output scale, redraws use the handles.
+ */
+static struct font_cache_entry {
+	const char *list;
+	int size;
+	struct fcft_font *font;
+} font_cache[FONT_CACHE_SIZE];
+static int font_cache_count = 0;
+
 static enum fcft_subpixel subpixel_mode = FCFT_SUBPIXEL_DEFAULT;
 
 static pixman_color_t fg = {0xffff, 0xffff, 0xffff, 0xffff};
@@ -50,78 +66,372 @@ static pixman_color_t mg = {0x4444, 0x4444, 0x4444, 0xffff};
 static pixman_color_t og = {0x9999, 0x9999, 0x9999, 0xffff};
 static pixman_color_t xy = {0x1fff, 0x1fff, 0x1fff, 0xffff};
 
+/*
+ * Glyph atlas: one strip per font and foreground colour, holding every
+ * glyph ws ever draws pre-composited over bg in fixed size cells, so a
+ * character is a single SRC blit.  The alphabet covers the workspace
+ * names stage uses, the clock, the status readouts and the cursor
+ * coordinates.
+ */
+#define	ATLAS_CHARS		"0123456789-=\\`ts:, .bclm"
+
+struct ws_atlas {
+	struct fcft_font *font;
+	pixman_color_t *color;
+	pixman_image_t *pix;
+	int cell_w;
+	int cell_h;
+	int8_t index[128];
+};
+
+/*
+ * The atlases for one output scale, rasterized from fonts sized for it,
+ * so glyphs land 1:1 on the device pixels.  The first set is scale 1.
+ */
+struct ws_atlases {
+	int scale;
+	struct ws_atlas *fg;		/* Current workspace. */
+	struct ws_atlas *mg;		/* Occupied workspaces. */
+	struct ws_atlas *og;		/* Previous workspace. */
+	struct ws_atlas *xy;		/* Cursor coordinates. */
+	struct ws_atlas *time;		/* Clock and status. */
+};
+
+static struct ws_atlases atlas_sets[ATLAS_SCALES];
+static int atlas_sets_count = 0;
+
+/* Bar layout of the text areas, in logical units. */
+#define	WS_X			50
+#define	WS_Y			100
+#define	WS_STEP			120
+#define	WS_CELLS		16	/* Workspaces stage has. */
+#define	XY_X			150
+#define	XY_STEP			120
+#define	XY_CELLS		9	/* xxxx,yyyy */
+#define	TIME_STEP		24
+#define	TIME_H			50
+#define	TIME_LEN		5	/* HH:MM */
+
+static void ws_text_init(struct ws_text *text, int x, int y, int dx, int dy,
+    int cell_w, int cell_h);
+
+/* Logical units to buffer pixels, rounding as wp_fractional_scale_v1. */
+static int
+ws_scaled(int v, int scale)
+{
+
+	return ((v * scale + WS_SCALE_BASE / 2) / WS_SCALE_BASE);
+}
+
+/*
+ * The width ws needs: the workspace column or the clock, whichever is
+ * wider.  Everything else on the output is left to the windows below.
+ */
+int
+ws_image_content_width(void)
+{
+	int width;
+
+	width = WS_X + atlas_sets[0].fg->cell_w;
+	if (width < TIME_STEP * TIME_LEN)
+		width = TIME_STEP * TIME_LEN;
+
+	return (width);
+}
+
+static void
+ws_panel_set(struct ws_panel *panel, struct ws_atlases *set, int x, int y,
+    int width, int height, int bar_height)
+{
+
+	if (y + height > bar_height)
+		height = bar_height - y;
+	if (height < 1)
+		height = 1;
+
+	panel->atlases = set;
+	panel->x = x;
+	panel->y = y;
+	panel->width = width;
+	panel->height = height;
+	panel->buf_width = ws_scaled(width, set->scale);
+	panel->buf_height = ws_scaled(height, set->scale);
+	if (panel->buf_width < 1)
+		panel->buf_width = 1;
+	if (panel->buf_height < 1)
+		panel->buf_height = 1;
+}
+
+/*
+ * Place the text areas for a bar of the given height.  Each panel is
+ * sized to the cells it can hold; cells tile without overlap so a
+ * redraw never touches a neighbour.  Positions and sizes are logical,
+ * the cells inside a panel are in pixels of the bar's scale.
+ */
+void
+ws_panel_layout(struct ws_surface *surf, int height)
+{
+	struct ws_atlases *set;
+	int scale;
+	int top;
+	int i;
+
+	set = ws_atlases_get(surf->scale);
+	scale = set->scale;
+
+	/* Status readouts stack up from the clock, the strip ends above. */
+	top = height - TIME_H * (surf->nstatus + 1);
+
+	ws_panel_set(&surf->strip, set, WS_X, WS_Y, atlas_sets[0].fg->cell_w,
+	    WS_STEP * WS_CELLS, top);
+	ws_text_init(&surf->strip.text, 0, 0, 0, ws_scaled(WS_STEP, scale),
+	    set->fg->cell_w, ws_scaled(WS_STEP, scale));
+
+	ws_panel_set(&surf->cursor, set, XY_X, 0, atlas_sets[0].xy->cell_w,
+	    XY_STEP * XY_CELLS, height);
+	ws_text_init(&surf->cursor.text, 0, 0, 0, ws_scaled(XY_STEP, scale),
+	    set->xy->cell_w, ws_scaled(XY_STEP, scale));
+
+	for (i = 0; i < surf->nstatus; i++) {
+		ws_panel_set(&surf->status[i], set, 0, top + TIME_H * i,
+		    TIME_STEP * WS_STATUS_LEN, TIME_H, height);
+		ws_text_init(&surf->status[i].text, 0, 0,
+		    ws_scaled(TIME_STEP, scale), 0,
+		    ws_scaled(TIME_STEP, scale), ws_scaled(TIME_H, scale));
+	}
+
+	ws_panel_set(&surf->clock, set, 0, height - TIME_H,
+	    TIME_STEP * TIME_LEN, TIME_H, height);
+	ws_text_init(&surf->clock.text, 0, 0, ws_scaled(TIME_STEP, scale), 0,
+	    ws_scaled(TIME_STEP, scale), ws_scaled(TIME_H, scale));
+}
+
+/*
+ * Buffers are opaque XRGB: bg is black, so the zero-filled memfd is
+ * already a blank panel, and the compositor does not need to blend it.
+ */
 struct ws_image *
 ws_image_create(char *name, size_t width, size_t height)
 {
-	char shm_name[NAME_MAX];
 	struct ws_image *image;
-	pixman_image_t *pixman;
+	struct ws_buffer *buf;
 	void *buffer;
 	size_t size;
 	int shmid;
 	int i;
 
-	shmid = -1;
-	size = width * height * 8;
-
-	for (i = 0; i < UCHAR_MAX; ++i) {
-		if (snprintf(shm_name, NAME_MAX, "/%s-%d", name, i) >= NAME_MAX)
-			break;
-
-		shmid = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
-		if (shmid > 0 || errno != EEXIST)
-			break;
-	}
+	size = width * height * 4 * WS_NBUFFERS;
 
+	shmid = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
 	if (shmid < 0) {
-		printf("shm_open() failed: %s", strerror(errno));
-		return (NULL);
-	}
-
-	if (shm_unlink(shm_name) != 0) {
-		printf("shm_unlink() failed: %s", strerror(errno));
+		printf("memfd_create() failed: %s", strerror(errno));
 		return (NULL);
 	}
 
 	if (ftruncate(shmid, size) != 0) {
 		printf("ftruncate() failed: %s", strerror(errno));
+		close(shmid);
 		return (NULL);
 	}
 
+	/* The compositor maps this too: it must never shrink under it. */
+	if (fcntl(shmid, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+	    F_SEAL_SEAL) != 0)
+		printf("fcntl(F_ADD_SEALS) failed: %s", strerror(errno));
+
 	buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shmid, 0);
 	if (buffer == MAP_FAILED) {
 		printf("mmap() failed: %s", strerror(errno));
+		close(shmid);
 		return (NULL);
 	}
 
-	pixman = pixman_image_create_bits_no_clear(PIXMAN_a8r8g8b8, width,
-	    height, buffer, width * 4);
-
-	image = malloc(sizeof(struct ws_image));
+	image = calloc(1, sizeof(struct ws_image));
 	image->shmid = shmid;
+	image->data = buffer;
+	image->pool_size = size;
 	image->width = width;
 	image->height = height;
 	image->size_in_bytes = width * height * 4;
 	image->stride = width * 4;
-	image->pixman = pixman;
+	pixman_region32_init(&image->damage);
+
+	for (i = 0; i < WS_NBUFFERS; i++) {
+		buf = &image->buffers[i];
+		buf->image = image;
+		buf->pixman = pixman_image_create_bits_no_clear(
+		    PIXMAN_x8r8g8b8, width, height,
+		    (uint32_t *)((char *)buffer + image->size_in_bytes * i),
+		    image->stride);
+		pixman_region32_init(&buf->stale);
+	}
 
 	return (image);
 }
 
+static void
+buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+	struct ws_image *image;
+	struct ws_buffer *buf;
+
+	buf = data;
+	image = buf->image;
+
+	/*
+	 * Read by the render thread picking its next back buffer.  Paired
+	 * with ws_image_begin(): either it sees this buffer free, or this
+	 * sees it waiting and has the draw done again.
+	 */
+	__atomic_store_n(&buf->busy, false, __ATOMIC_SEQ_CST);
+
+	if (__atomic_exchange_n(&image->waiting, false, __ATOMIC_SEQ_CST) &&
+	    image->released != NULL)
+		image->released(image->released_arg);
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	.release = buffer_release,
+};
+
+/* Carve WS_NBUFFERS wl_buffers out of the image's pool fd. */
+int
+ws_image_attach(struct ws_image *image, struct wl_shm *wl_shm)
+{
+	struct wl_shm_pool *pool;
+	struct ws_buffer *buf;
+	int i;
+
+	pool = wl_shm_create_pool(wl_shm, image->shmid, image->pool_size);
+	if (pool == NULL) {
+		printf("wl_shm_create_pool failed");
+		return (-1);
+	}
+
+	for (i = 0; i < WS_NBUFFERS; i++) {
+		buf = &image->buffers[i];
+		buf->wl_buffer = wl_shm_pool_create_buffer(pool,
+		    image->size_in_bytes * i, image->width, image->height,
+		    image->stride, WL_SHM_FORMAT_XRGB8888);
+		if (buf->wl_buffer == NULL) {
+			printf("wl_shm_pool_create_buffer failed");
+			wl_shm_pool_destroy(pool);
+			return (-1);
+		}
+		wl_buffer_add_listener(buf->wl_buffer, &buffer_listener, buf);
+	}
+
+	wl_shm_pool_destroy(pool);
+
+	image->ready = true;
+
+	return (0);
+}
+
 void
 ws_image_destroy(struct ws_image *image)
 {
-	pixman_image_t *pixman;
+	struct ws_buffer *buf;
+	int i;
 
-	pixman = image->pixman;
-	pixman_image_unref(pixman);
+	for (i = 0; i < WS_NBUFFERS; i++) {
+		buf = &image->buffers[i];
+		if (buf->wl_buffer != NULL)
+			wl_buffer_destroy(buf->wl_buffer);
+		pixman_image_unref(buf->pixman);
+		pixman_region32_fini(&buf->stale);
+	}
+
+	pixman_region32_fini(&image->damage);
+	munmap(image->data, image->pool_size);
+	close(image->shmid);
 
 	free(image);
 }
 
-void
-ws_font_init(void)
+/*
+ * Pick a buffer the compositor is not reading and bring it up to date
+ * with the last committed frame by copying only what changed since it
+ * was last drawn into.  Returns false if every buffer is still held:
+ * the draw is skipped and done again once one is released.
+ */
+bool
+ws_image_begin(struct ws_image *image)
 {
+	struct ws_buffer *buf, *back;
+	pixman_box32_t *rects;
+	int nrects;
+	int i;
+
+	if (image->back != NULL)
+		return (true);
+
+	__atomic_store_n(&image->waiting, true, __ATOMIC_SEQ_CST);
+
+	back = NULL;
+	for (i = 0; i < WS_NBUFFERS; i++) {
+		buf = &image->buffers[i];
+		if (__atomic_load_n(&buf->busy, __ATOMIC_SEQ_CST))
+			continue;
+		if (back == NULL || back == image->front)
+			back = buf;
+	}
+
+	if (back == NULL)
+		return (false);
+
+	__atomic_store_n(&image->waiting, false, __ATOMIC_SEQ_CST);
+
+	if (back != image->front && image->front != NULL) {
+		rects = pixman_region32_rectangles(&back->stale, &nrects);
+		for (i = 0; i < nrects; i++)
+			pixman_image_composite32(PIXMAN_OP_SRC,
+			    image->front->pixman, NULL, back->pixman,
+			    rects[i].x1, rects[i].y1, 0, 0,
+			    rects[i].x1, rects[i].y1,
+			    rects[i].x2 - rects[i].x1,
+			    rects[i].y2 - rects[i].y1);
+	}
+
+	pixman_region32_clear(&back->stale);
+
+	image->back = back;
+	image->pixman = back->pixman;
+
+	return (true);
+}
+
+/* Finish drawing: returns the back buffer, now the one to commit. */
+struct ws_buffer *
+ws_image_end(struct ws_image *image)
+{
+	struct ws_buffer *back, *buf;
+	int i;
+
+	back = image->back;
+	if (back == NULL)
+		return (NULL);
+
+	for (i = 0; i < WS_NBUFFERS; i++) {
+		buf = &image->buffers[i];
+		if (buf != back)
+			pixman_region32_union(&buf->stale, &buf->stale,
+			    &image->damage);
+	}
+
+	pixman_region32_clear(&image->damage);
+
+	back->busy = true;
+	image->front = back;
+	image->back = NULL;
+
+	return (back);
+}
+
+static struct fcft_font *
+ws_font_load(const char *list, int size)
+{
+	struct fcft_font *font;
 	char **names;
 	char *copy;
 	char *name;
@@ -131,7 +441,7 @@ ws_font_init(void)
 	/* Instantiate font, and fallbacks. */
 	tll(const char *)font_names = tll_init();
 
-	copy = strdup(font_list);
+	copy = strdup(list);
 	for (name = strtok(copy, ",");
 	    name != NULL;
 	    name = strtok(NULL, ",")) {
@@ -146,15 +456,57 @@ ws_font_init(void)
 
 	i = 0;
 	names = malloc(sizeof (char *) * tll_length(font_names));
-	tll_foreach(font_names, it)
-		names[i++] = (char *)it->item;
+	tll_foreach(font_names, it) {
+		len = strlen(it->item) + 16;
+		names[i] = malloc(len);
+		snprintf(names[i++], len, "%s:size=%d", it->item, size);
+	}
 
 	font = fcft_from_name(tll_length(font_names), (const char **)names,
 	    NULL);
 	assert(font != NULL);
 	fcft_set_emoji_presentation(font, FCFT_EMOJI_PRESENTATION_DEFAULT);
+
+	while (i > 0)
+		free(names[--i]);
+	free(names);
 	tll_free(font_names);
 	free(copy);
+
+	return (font);
+}
+
+struct fcft_font *
+ws_font_get(const char *list, int size)
+{
+	struct font_cache_entry *entry;
+	int i;
+
+	for (i = 0; i < font_cache_count; i++) {
+		entry = &font_cache[i];
+		if (entry->size == size && strcmp(entry->list, list) == 0)
+			return (entry->font);
+	}
+
+	assert(font_cache_count < FONT_CACHE_SIZE);
+
+	entry = &font_cache[font_cache_count++];
+	entry->list = list;
+	entry->size = size;
+	entry->font = ws_font_load(list, size);
+
+	return (entry->font);
+}
+
+void
+ws_font_fini(void)
+{
+	int i;
+
+	for (i = 0; i < font_cache_count; i++)
+		fcft_destroy(font_cache[i].font);
+
+	font_cache_count = 0;
 }
 
 void
@@ -167,22 +519,20 @@ ws_image_clear(struct ws_image *image, pixman_color_t *color, int x, int y,
 
 	pixman_image_fill_rectangles(PIXMAN_OP_SRC, pixman, color, 1,
 	    &(pixman_rectangle16_t){x, y, w, h});
+	pixman_region32_union_rect(&image->damage, &image->damage, x, y, w, h);
 }
 
-void
-ws_image_draw(struct ws_image *image, pixman_color_t *color,
-    char c, int offset_x, int offset_y)
+static void
+ws_glyph_render(pixman_image_t *pixman, struct fcft_font *font,
+    pixman_color_t *color, char c, int offset_x, int offset_y)
 {
 	const struct fcft_glyph *g;
-	pixman_image_t *pixman;
 	pixman_image_t *clr_pix;
 
 	g = fcft_rasterize_char_utf32(font, c, subpixel_mode);
 	if (g == NULL)
 		return;
 
-	pixman = image->pixman;
-
 	if (pixman_image_get_format(g->pix) == PIXMAN_a8r8g8b8) {
 		pixman_image_composite32(
 			PIXMAN_OP_OVER, g->pix, NULL, pixman, 0, 0, 0, 0,
@@ -194,64 +544,250 @@ ws_image_draw(struct ws_image *image, pixman_color_t *color,
 			PIXMAN_OP_OVER, clr_pix, g->pix, pixman, 0, 0, 0, 0,
 			    offset_x + g->x, offset_y + font->ascent - g->y,
 			    g->width, g->height);
+		pixman_image_unref(clr_pix);
 	}
 }
 
+static struct ws_atlas *
+ws_atlas_create(struct fcft_font *font, pixman_color_t *color)
+{
+	pixman_region32_t clip;
+	struct ws_atlas *atlas;
+	const char *chars;
+	int n;
+	int i;
+
+	chars = ATLAS_CHARS;
+	n = strlen(chars);
+
+	atlas = calloc(1, sizeof(struct ws_atlas));
+	if (atlas == NULL)
+		return (NULL);
+
+	atlas->font = font;
+	atlas->color = color;
+	atlas->cell_w = font->max_advance.x;
+	atlas->cell_h = font->ascent + font->descent;
+	memset(atlas->index, -1, sizeof(atlas->index));
+
+	atlas->pix = pixman_image_create_bits_no_clear(PIXMAN_a8r8g8b8,
+	    atlas->cell_w * n, atlas->cell_h, NULL, 0);
+	if (atlas->pix == NULL) {
+		free(atlas);
+		return (NULL);
+	}
+
+	pixman_image_fill_rectangles(PIXMAN_OP_SRC, atlas->pix, &bg, 1,
+	    &(pixman_rectangle16_t){0, 0, atlas->cell_w * n, atlas->cell_h});
+
+	/* Clip each glyph to its own cell. */
+	for (i = 0; i < n; i++) {
+		pixman_region32_init_rect(&clip, atlas->cell_w * i, 0,
+		    atlas->cell_w, atlas->cell_h);
+		pixman_image_set_clip_region32(atlas->pix, &clip);
+		pixman_region32_fini(&clip);
+
+		ws_glyph_render(atlas->pix, font, color, chars[i],
+		    atlas->cell_w * i, 0);
+		atlas->index[(int)chars[i]] = i;
+	}
+
+	pixman_image_set_clip_region32(atlas->pix, NULL);
+
+	return (atlas);
+}
+
+static void
+ws_atlas_destroy(struct ws_atlas *atlas)
+{
+
+	if (atlas == NULL)
+		return;
+
+	pixman_image_unref(atlas->pix);
+	free(atlas);
+}
+
+/*
+ * The atlases for a scale, made on first use.  Once every slot is taken
+ * further scales fall back to scale 1 and let the compositor scale.
+ * Called from the event thread only, with the render thread idle.
+ */
+struct ws_atlases *
+ws_atlases_get(int scale)
+{
+	struct fcft_font *large, *small;
+	struct ws_atlases *set;
+	int i;
+
+	for (i = 0; i < atlas_sets_count; i++)
+		if (atlas_sets[i].scale == scale)
+			return (&atlas_sets[i]);
+
+	if (atlas_sets_count == ATLAS_SCALES)
+		return (&atlas_sets[0]);
+
+	large = ws_font_get(FONT_LIST, ws_scaled(FONT_SIZE_LARGE, scale));
+	small = ws_font_get(FONT_LIST, ws_scaled(FONT_SIZE_SMALL, scale));
+
+	set = &atlas_sets[atlas_sets_count++];
+	set->scale = scale;
+	set->fg = ws_atlas_create(large, &fg);
+	set->mg = ws_atlas_create(large, &mg);
+	set->og = ws_atlas_create(large, &og);
+	set->xy = ws_atlas_create(large, &xy);
+	set->time = ws_atlas_create(small, &fg);
+
+	return (set);
+}
+
 void
-draw_cursor_xy(struct ws *app, char *buf)
+ws_atlas_init(void)
 {
-	static pixman_color_t *color;
-	int voffs;
+
+	ws_atlases_get(WS_SCALE_BASE);
+}
+
+void
+ws_atlas_fini(void)
+{
+	struct ws_atlases *set;
 	int i;
-	char c;
 
-	i = 0;
-	voffs = 0;
+	for (i = 0; i < atlas_sets_count; i++) {
+		set = &atlas_sets[i];
+		ws_atlas_destroy(set->fg);
+		ws_atlas_destroy(set->mg);
+		ws_atlas_destroy(set->og);
+		ws_atlas_destroy(set->xy);
+		ws_atlas_destroy(set->time);
+		memset(set, 0, sizeof(struct ws_atlases));
+	}
 
-	font_list = "ubuntu mono:size=120";
-	ws_font_init();
+	atlas_sets_count = 0;
+}
 
-	ws_image_clear(app->image, &bg, 150, 0, app->width-150, app->height);
+/*
+ * Draw the top left w x h of a character cell at offset_x, offset_y.
+ * Characters outside the atlas alphabet are rasterized directly.
+ */
+void
+ws_image_draw(struct ws_image *image, struct ws_atlas *atlas, char c,
+    int offset_x, int offset_y, int w, int h)
+{
+	int idx;
+
+	if (w > atlas->cell_w)
+		w = atlas->cell_w;
+	if (h > atlas->cell_h)
+		h = atlas->cell_h;
+
+	idx = ((unsigned char)c < 128) ? atlas->index[(int)c] : -1;
+	if (idx < 0) {
+		ws_image_clear(image, &bg, offset_x, offset_y, w, h);
+		ws_glyph_render(image->pixman, atlas->font, atlas->color, c,
+		    offset_x, offset_y);
+		return;
+	}
 
-	while (1) {
-		c = buf[i++];
+	pixman_image_composite32(PIXMAN_OP_SRC, atlas->pix, NULL,
+	    image->pixman, atlas->cell_w * idx, 0, 0, 0, offset_x, offset_y,
+	    w, h);
+	pixman_region32_union_rect(&image->damage, &image->damage, offset_x,
+	    offset_y, w, h);
+}
 
-		if (c == '\0')
-			break;
+/*
+ * A line of character cells.  It remembers what is on screen, so an
+ * update only redraws, and damages, the cells that changed.
+ */
+static void
+ws_text_init(struct ws_text *text, int x, int y, int dx, int dy,
+    int cell_w, int cell_h)
+{
+
+	memset(text, 0, sizeof(struct ws_text));
+	text->x = x;
+	text->y = y;
+	text->dx = dx;
+	text->dy = dy;
+	text->cell_w = cell_w;
+	text->cell_h = cell_h;
+}
+
+static void
+ws_text_update(struct ws_image *image, struct ws_text *text,
+    const char *chars, struct ws_atlas **atlas, int n)
+{
+	int x, y;
+	int i;
+
+	if (n > TEXT_MAX)
+		n = TEXT_MAX;
+
+	for (i = 0; i < n; i++) {
+		if (i < text->len && text->chars[i] == chars[i] &&
+		    text->atlas[i] == atlas[i])
+			continue;
+
+		x = text->x + text->dx * i;
+		y = text->y + text->dy * i;
+		ws_image_draw(image, atlas[i], chars[i], x, y, text->cell_w,
+		    text->cell_h);
+
+		text->chars[i] = chars[i];
+		text->atlas[i] = atlas[i];
+	}
+
+	for (; i < text->len; i++) {
+		x = text->x + text->dx * i;
+		y = text->y + text->dy * i;
+		ws_image_clear(image, &bg, x, y, text->cell_w, text->cell_h);
+	}
 
-		color = &xy;
+	text->len = n;
+}
 
-		if (c == ',')
-			ws_image_draw(app->image, color, ' ', 150, voffs);
-		else
-			ws_image_draw(app->image, color, c, 150, voffs);
+void
+draw_cursor_xy(struct ws_panel *panel, char *buf)
+{
+	struct ws_atlas *atlas[TEXT_MAX];
+	char chars[TEXT_MAX];
+	int n;
+	char c;
 
-		voffs += 120;
+	if (panel->image == NULL)
+		return;
+
+	for (n = 0; n < TEXT_MAX && (c = buf[n]) != '\0'; n++) {
+		chars[n] = (c == ',') ? ' ' : c;
+		atlas[n] = panel->atlases->xy;
 	}
 
-	ws_flush(app);
+	if (!ws_image_begin(panel->image))
+		return;
+	ws_text_update(panel->image, &panel->text, chars, atlas, n);
 }
 
 void
-draw_numbers(struct ws *app, char *buf)
+draw_numbers(struct ws_panel *panel, char *buf)
 {
-	static pixman_color_t *color;
+	struct ws_atlas *atlas[TEXT_MAX];
+	char chars[TEXT_MAX];
 	int oldflag;
 	int newflag;
-	int voffs;
+	int n;
 	int i;
 	char c;
 
-	font_list = "ubuntu mono:size=120";
-	ws_font_init();
+	if (panel->image == NULL)
+		return;
 
 	i = 0;
-	voffs = 100;
+	n = 0;
 	oldflag = newflag = 0;
 
-	ws_image_clear(app->image, &bg, 0, 0, 150, app->height - 100);
-
-	while (1) {
+	while (n < TEXT_MAX) {
 		c = buf[i++];
 
 		if (c == '\0')
@@ -267,60 +803,53 @@ draw_numbers(struct ws *app, char *buf)
 			continue;
 		}
 
-		/* printf("c %c ws %d\n", c, ws); */
-
 		if (newflag) {
-			color = &fg;
+			atlas[n] = panel->atlases->fg;
 			newflag = 0;
 		} else if (oldflag) {
-			color = &og;
+			atlas[n] = panel->atlases->og;
 			oldflag = 0;
 		} else
-			color = &mg;
+			atlas[n] = panel->atlases->mg;
 
-		ws_image_draw(app->image, color, c, 50, voffs);
-
-		voffs += 120;
+		chars[n++] = c;
 	}
 
-	ws_flush(app);
+	if (!ws_image_begin(panel->image))
+		return;
+	ws_text_update(panel->image, &panel->text, chars, atlas, n);
 }
 
-static char time_last[128];
-
 void
-ws_draw_time(struct ws *app)
+ws_draw_time(struct ws_panel *panel, const char *buf)
 {
-	time_t now = time(NULL);
-	struct tm *t = localtime(&now);
-	char buffer[128];
-	int xpos;
-	int ypos;
-	char c;
-	int i;
-	int font_w;
+	struct ws_atlas *atlas[TEXT_MAX];
+	int n;
 
-	strftime(buffer, sizeof(buffer), "%H:%M", t);
-	if (strcmp(buffer, time_last) == 0)
+	if (panel->image == NULL)
 		return;
 
-	font_list = "ubuntu mono:size=50";
-	ws_font_init();
-
-	xpos = 0;
-	ypos = 1080 * 2 - 50;
+	for (n = 0; n < TIME_LEN && buf[n] != '\0'; n++)
+		atlas[n] = panel->atlases->time;
 
-	font_w = 24;
+	if (!ws_image_begin(panel->image))
+		return;
+	ws_text_update(panel->image, &panel->text, buf, atlas, n);
+}
 
-	ws_image_clear(app->image, &bg, xpos, ypos, 200, 50);
+void
+ws_draw_status(struct ws_panel *panel, const char *buf)
+{
+	struct ws_atlas *atlas[TEXT_MAX];
+	int n;
 
-	for (i = 0; i < strlen(buffer); i++) {
-		c = buffer[i];
-		ws_image_draw(app->image, &fg, c, xpos, ypos);
-		xpos += font_w;
-	}
+	if (panel->image == NULL)
+		return;
 
-	strcpy(time_last, buffer);
+	for (n = 0; n < WS_STATUS_LEN && buf[n] != '\0'; n++)
+		atlas[n] = panel->atlases->time;
 
-	ws_flush(app);
+	if (!ws_image_begin(panel->image))
+		return;
+	ws_text_update(panel->image, &panel->text, buf, atlas, n);
 }
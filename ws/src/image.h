@@ -26,39 +26,143 @@
 #ifndef _IMAGE_H_
 #define _IMAGE_H_
 
-#define	MAX_WIDTH		400
-#define	MAX_HEIGHT		(1080 * 2)
-#define	SERVER_SOCK_FILE	"/tmp/stage.sock"
+
+#define	WS_NBUFFERS		3
+#define	WS_STATUS_MAX		4	/* Status modules shown. */
+#define	WS_STATUS_LEN		5	/* Characters per readout. */
+#define	WS_STRIP_LEN		64	/* Workspace strip, with markers. */
+#define	WS_SCALE_BASE		120	/* Scales are in 120ths. */
+
+struct ws_image;
+
+struct ws_buffer {
+	struct ws_image *image;
+	struct wl_buffer *wl_buffer;
+	pixman_image_t *pixman;
+	pixman_region32_t stale;	/* Changed since last drawn into. */
+	bool busy;			/* Held by the compositor. */
+};
 
 struct ws_image {
 	size_t width;
 	size_t height;
-	size_t size_in_bytes;
+	size_t size_in_bytes;		/* Per buffer. */
 	size_t stride;
 	int shmid;
-	void *pixman;
+	void *data;
+	size_t pool_size;
+	bool ready;
+	struct ws_buffer buffers[WS_NBUFFERS];
+	struct ws_buffer *back;		/* Being drawn. */
+	struct ws_buffer *front;	/* Last committed. */
+	pixman_region32_t damage;	/* Drawn since the last commit. */
+	void *pixman;			/* Pixels of the back buffer. */
+	bool waiting;			/* A draw waits for a release. */
+	void (*released)(void *arg);	/* Called when it can go on. */
+	void *released_arg;
+};
+
+struct ws_atlas;
+struct ws_atlases;
+
+#define	TEXT_MAX		32
+
+/* A line of character cells, see ws_text_update(). */
+struct ws_text {
+	int x;
+	int y;
+	int dx;			/* Step to the next cell. */
+	int dy;
+	int cell_w;
+	int cell_h;
+	int len;
+	char chars[TEXT_MAX];
+	struct ws_atlas *atlas[TEXT_MAX];
+};
+
+/*
+ * A text area: a subsurface of the bar with its own small buffer set.
+ * Only these carry shm pixels, the rest of the bar is a single pixel.
+ * The buffers are in device pixels, the viewport maps them back to the
+ * panel's logical size.
+ */
+struct ws_panel {
+	struct wl_surface *wl_surface;
+	struct wl_subsurface *wl_subsurface;
+	struct wp_viewport *viewport;
+	struct ws_image *image;
+	struct ws_atlases *atlases;
+	struct ws_text text;
+	int x;			/* Position in the bar. */
+	int y;
+	int width;		/* Logical size. */
+	int height;
+	int buf_width;		/* Buffer size. */
+	int buf_height;
 };
 
 struct ws_surface {
 	struct zwlr_layer_surface_v1 *wlr_layer_surface;
 	struct wl_surface *wl_surface;
+	struct wp_viewport *viewport;
+	struct wl_buffer *bg;
+	struct ws_panel strip;		/* Workspaces. */
+	struct ws_panel clock;
+	struct ws_panel cursor;
+	struct ws_panel status[WS_STATUS_MAX];
+	struct wp_fractional_scale_v1 *fractional;
+	int preferred_scale;		/* From fractional, 0 until sent. */
+	int scale;			/* The panels are laid out for. */
+	int nstatus;
+	int height;
+	bool commit;			/* Bar state to commit. */
 };
 
 struct ws_output {
 	struct wl_list link;
+	struct ws *app;
+	uint32_t global;		/* Registry name. */
 	struct wl_output *wl_output;
 	struct ws_surface *ws_surface;
+	struct wl_callback *frame_cb;
+	int32_t scale;			/* wl_output integer scale. */
+	bool dirty;
+	char *name;
+};
+
+struct ws_group;
+
+struct ws_workspace {
+	struct wl_list link;
+	struct ext_workspace_handle_v1 *handle;
+	struct ws_group *group;
+	char *name;
+	uint32_t state;
+};
+
+struct ws_group {
+	struct wl_list link;
+	struct ws *app;
+	struct ext_workspace_group_handle_v1 *handle;
+	struct wl_output *wl_output;
+	struct ws_workspace *active;
+	struct ws_workspace *previous;
 };
 
 struct ws {
-	struct ws_image *image;
-	struct wl_buffer *wl_buffer;
 	struct wl_compositor *wl_compositor;
+	struct wl_subcompositor *wl_subcompositor;
+	struct wp_viewporter *viewporter;
+	struct wp_single_pixel_buffer_manager_v1 *single_pixel;
+	struct wp_fractional_scale_manager_v1 *fractional_scale;
 	struct wl_display *wl_display;
-	struct ws_output *output;
+	struct wl_list outputs;
 	struct wl_registry *wl_registry;
 	struct wl_shm *wl_shm;
 	struct zwlr_layer_shell_v1 *wlr_layer_shell;
+	struct ext_workspace_manager_v1 *workspace_manager;
+	struct wl_list groups;
+	struct wl_list workspaces;
 	char *name;
 	int margin_top;
 	int margin_right;
@@ -67,14 +171,54 @@ struct ws {
 	int width;
 	int height;
 	int anchor;
+	bool cursor;			/* Show pointer coordinates. */
+	int cursor_x;
+	int cursor_y;
 };
 
 struct ws_image *ws_image_create(char *name, size_t width, size_t height);
+int ws_image_content_width(void);
+int ws_image_attach(struct ws_image *image, struct wl_shm *wl_shm);
 void ws_image_destroy(struct ws_image *image);
-void ws_image_draw(struct ws_image *image, pixman_color_t *color, char c,
-    int offset_x, int offset_y);
-void ws_font_init(void);
+bool ws_image_begin(struct ws_image *image);
+struct ws_buffer *ws_image_end(struct ws_image *image);
+void ws_panel_layout(struct ws_surface *surf, int height);
+
+void ws_image_draw(struct ws_image *image, struct ws_atlas *atlas, char c,
+    int offset_x, int offset_y, int w, int h);
+void ws_atlas_init(void);
+void ws_atlas_fini(void);
+struct ws_atlases *ws_atlases_get(int scale);
+struct fcft_font *ws_font_get(const char *list, int size);
+void ws_font_fini(void);
 void ws_image_clear(struct ws_image *image, pixman_color_t *color, int x,
     int y, int w, int h);
+void draw_numbers(struct ws_panel *panel, char *buf);
+void draw_cursor_xy(struct ws_panel *panel, char *buf);
+void ws_draw_time(struct ws_panel *panel, const char *buf);
+void ws_draw_status(struct ws_panel *panel, const char *buf);
+void ws_flush(struct ws_output *output);
+
+void ws_workspace_init(struct ws *app);
+void ws_workspace_text(struct ws_output *output, char *buf, size_t len);
+void ws_workspace_output_remove(struct ws *app, struct wl_output *wl_output);
+void ws_schedule(struct ws *app);
+
+int ws_render_init(void);
+void ws_render_fini(void);
+void ws_render_kick(struct ws *app);
+void ws_render_done(struct ws *app);
+void ws_render_sync(void);
+
+int ws_cursor_init(void);
+void ws_cursor_fini(void);
+bool ws_cursor_sample(struct ws *app);
+void ws_cursor_moved(struct ws *app);
+
+int ws_status_init(void);
+void ws_status_fini(void);
+void ws_status_expire(struct ws *app);
+int ws_status_count(void);
+const char *ws_status_text(int i);
 
 #endif /* !_IMAGE_H_ */
@@ -23,37 +23,221 @@
  * SUCH DAMAGE.
  */
 
-#include <sys/socket.h>
-#include <sys/un.h>
 #include <sys/timerfd.h>
 #include <sys/epoll.h>
 
 #include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <pixman.h>
 
 #include <fcft/fcft.h>
 
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
+#include "ext-workspace-v1-client-protocol.h"
+#include "fractional-scale-v1-client-protocol.h"
+#include "single-pixel-buffer-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
 #include "image.h"
 
 static int timer_fd;
+static int status_fd = -1;
+static int render_fd = -1;
+static int cursor_fd = -1;
+
+/* A panel had every buffer held: draw again now that one is back. */
+static void
+ws_panel_released(void *arg)
+{
+
+	ws_schedule(arg);
+}
+
+/* (Re)allocate the buffer set of a panel at its current size. */
+static int
+ws_panel_alloc(struct ws *app, struct ws_panel *panel)
+{
+	struct ws_image *image;
+
+	image = ws_image_create(app->name, panel->buf_width,
+	    panel->buf_height);
+	if (image == NULL)
+		return (-1);
+
+	if (ws_image_attach(image, app->wl_shm) != 0) {
+		ws_image_destroy(image);
+		return (-1);
+	}
+
+	image->released = ws_panel_released;
+	image->released_arg = app;
+
+	if (panel->image != NULL)
+		ws_image_destroy(panel->image);
+	panel->image = image;
+
+	return (0);
+}
+
+static void
+ws_panel_create(struct ws *app, struct ws_surface *surf,
+    struct ws_panel *panel)
+{
+	struct wl_region *region;
+
+	panel->wl_surface = wl_compositor_create_surface(app->wl_compositor);
+	panel->wl_subsurface = wl_subcompositor_get_subsurface(
+	    app->wl_subcompositor, panel->wl_surface, surf->wl_surface);
+	panel->viewport = wp_viewporter_get_viewport(app->viewporter,
+	    panel->wl_surface);
+
+	/* Input goes to the bar itself. */
+	region = wl_compositor_create_region(app->wl_compositor);
+	wl_surface_set_input_region(panel->wl_surface, region);
+	wl_region_destroy(region);
+}
+
+static void
+ws_panel_destroy(struct ws_panel *panel)
+{
+
+	if (panel->image != NULL)
+		ws_image_destroy(panel->image);
+	if (panel->viewport != NULL)
+		wp_viewport_destroy(panel->viewport);
+	if (panel->wl_subsurface != NULL)
+		wl_subsurface_destroy(panel->wl_subsurface);
+	if (panel->wl_surface != NULL)
+		wl_surface_destroy(panel->wl_surface);
+	memset(panel, 0, sizeof(struct ws_panel));
+}
+
+static void
+ws_panel_place(struct ws_panel *panel)
+{
+
+	wl_subsurface_set_position(panel->wl_subsurface, panel->x, panel->y);
+	wp_viewport_set_destination(panel->viewport, panel->width,
+	    panel->height);
+}
+
+/*
+ * The scale to render the bar at: the fractional one if the compositor
+ * sends it, the output's integer scale otherwise.
+ */
+static int
+ws_output_scale(struct ws_output *output)
+{
+	struct ws_surface *surf;
+
+	surf = output->ws_surface;
+	if (surf != NULL && surf->preferred_scale != 0)
+		return (surf->preferred_scale);
+
+	return (output->scale * WS_SCALE_BASE);
+}
+
+/*
+ * The bar is a single black pixel stretched by the viewport; only the
+ * text panels on top of it are backed by shm.
+ */
+static void
+ws_resize(struct ws_output *output, int height)
+{
+	struct ws_surface *surf;
+	struct ws *app;
+	int i;
+
+	app = output->app;
+	surf = output->ws_surface;
+
+	/* The render thread may be drawing into the panels we replace. */
+	ws_render_sync();
+
+	surf->height = height;
+	surf->scale = ws_output_scale(output);
+
+	ws_panel_layout(surf, height);
+
+	ws_panel_place(&surf->strip);
+	ws_panel_place(&surf->clock);
+	ws_panel_place(&surf->cursor);
+	for (i = 0; i < surf->nstatus; i++)
+		ws_panel_place(&surf->status[i]);
+
+	ws_panel_alloc(app, &surf->strip);
+	ws_panel_alloc(app, &surf->clock);
+	for (i = 0; i < surf->nstatus; i++)
+		ws_panel_alloc(app, &surf->status[i]);
+	/* Without the overlay the cursor panel stays unbacked, so unmapped. */
+	if (app->cursor)
+		ws_panel_alloc(app, &surf->cursor);
+
+	wl_surface_attach(surf->wl_surface, surf->bg, 0, 0);
+	wp_viewport_set_destination(surf->viewport, app->width, height);
+	wl_surface_damage_buffer(surf->wl_surface, 0, 0, INT32_MAX,
+	    INT32_MAX);
+	surf->commit = true;
+
+	output->dirty = true;
+	ws_render_kick(app);
+}
 
 void
 layer_surface_configure(void *data, struct zwlr_layer_surface_v1 *surface,
     uint32_t serial, uint32_t w, uint32_t h)
 {
+	struct ws_output *output;
+	struct ws_surface *surf;
+
+	output = data;
+	surf = output->ws_surface;
 
 	zwlr_layer_surface_v1_ack_configure(surface, serial);
+
+	/*
+	 * Keep the width we asked for, the content never needs more.  The
+	 * height is the output's, so the clock sits at its bottom.
+	 */
+	if (h == 0 || surf->height == h) {
+		surf->commit = true;
+		ws_schedule(output->app);
+		return;
+	}
+
+	ws_resize(output, h);
 }
 
+/* Re-render the bar at the new scale once it has a size. */
+static void
+ws_rescale(struct ws_output *output)
+{
+	struct ws_surface *surf;
+
+	surf = output->ws_surface;
+	if (surf == NULL || surf->height == 0 ||
+	    surf->scale == ws_output_scale(output))
+		return;
+
+	ws_resize(output, surf->height);
+}
+
+static void ws_output_unmap(struct ws_output *output);
+
 void
 layer_surface_closed(void *data, struct zwlr_layer_surface_v1 *surface)
 {
+	struct ws_output *output;
 
+	output = data;
+
+	/* The output stays, it just shows no bar until it comes back. */
+	ws_output_unmap(output);
 }
 
 const static struct zwlr_layer_surface_v1_listener
@@ -62,10 +246,27 @@ const static struct zwlr_layer_surface_v1_listener
 	.closed = layer_surface_closed,
 };
 
+static void
+fractional_preferred_scale(void *data,
+    struct wp_fractional_scale_v1 *fractional, uint32_t scale)
+{
+	struct ws_output *output;
+
+	output = data;
+	output->ws_surface->preferred_scale = scale;
+
+	ws_rescale(output);
+}
+
+static const struct wp_fractional_scale_v1_listener fractional_listener = {
+	.preferred_scale = fractional_preferred_scale,
+};
+
 struct ws_surface *
-ws_surface_create(struct ws *app, struct wl_output *wl_output)
+ws_surface_create(struct ws *app, struct ws_output *output)
 {
 	struct ws_surface *ws_surface;
+	int i;
 
 	ws_surface = calloc(1, sizeof(struct ws_surface));
 	if (ws_surface == NULL) {
@@ -82,7 +283,7 @@ ws_surface_create(struct ws *app, struct wl_output *wl_output)
 
 	ws_surface->wlr_layer_surface =
 	    zwlr_layer_shell_v1_get_layer_surface(app->wlr_layer_shell,
-	    ws_surface->wl_surface, wl_output,
+	    ws_surface->wl_surface, output->wl_output,
 	    ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, "ws");
 	if (ws_surface->wlr_layer_surface == NULL) {
 		printf("wlr_layer_shell_v1_get_layer_surface failed");
@@ -97,7 +298,27 @@ ws_surface_create(struct ws *app, struct wl_output *wl_output)
 	zwlr_layer_surface_v1_set_anchor(ws_surface->wlr_layer_surface,
 	    app->anchor);
 	zwlr_layer_surface_v1_add_listener(ws_surface->wlr_layer_surface,
-	    &zwlr_layer_surface_listener, app);
+	    &zwlr_layer_surface_listener, output);
+
+	ws_surface->viewport = wp_viewporter_get_viewport(app->viewporter,
+	    ws_surface->wl_surface);
+	if (app->fractional_scale != NULL) {
+		ws_surface->fractional =
+		    wp_fractional_scale_manager_v1_get_fractional_scale(
+		    app->fractional_scale, ws_surface->wl_surface);
+		wp_fractional_scale_v1_add_listener(ws_surface->fractional,
+		    &fractional_listener, output);
+	}
+	ws_surface->bg = wp_single_pixel_buffer_manager_v1_create_u32_rgba_buffer(
+	    app->single_pixel, 0, 0, 0, UINT32_MAX);
+
+	ws_panel_create(app, ws_surface, &ws_surface->strip);
+	ws_panel_create(app, ws_surface, &ws_surface->clock);
+	ws_panel_create(app, ws_surface, &ws_surface->cursor);
+
+	ws_surface->nstatus = ws_status_count();
+	for (i = 0; i < ws_surface->nstatus; i++)
+		ws_panel_create(app, ws_surface, &ws_surface->status[i]);
 
 	return (ws_surface);
 }
@@ -105,26 +326,117 @@ ws_surface_create(struct ws *app, struct wl_output *wl_output)
 void
 ws_surface_destroy(struct ws_surface *ws_surface)
 {
-
+	int i;
+
+	ws_panel_destroy(&ws_surface->strip);
+	ws_panel_destroy(&ws_surface->clock);
+	ws_panel_destroy(&ws_surface->cursor);
+	for (i = 0; i < ws_surface->nstatus; i++)
+		ws_panel_destroy(&ws_surface->status[i]);
+	if (ws_surface->fractional != NULL)
+		wp_fractional_scale_v1_destroy(ws_surface->fractional);
+	wp_viewport_destroy(ws_surface->viewport);
+	wl_buffer_destroy(ws_surface->bg);
 	zwlr_layer_surface_v1_destroy(ws_surface->wlr_layer_surface);
 	wl_surface_destroy(ws_surface->wl_surface);
 
 	free(ws_surface);
 }
 
+static void
+ws_output_unmap(struct ws_output *output)
+{
+
+	ws_render_sync();
+
+	if (output->frame_cb != NULL) {
+		wl_callback_destroy(output->frame_cb);
+		output->frame_cb = NULL;
+	}
+
+	if (output->ws_surface != NULL) {
+		ws_surface_destroy(output->ws_surface);
+		output->ws_surface = NULL;
+	}
+}
+
 void
 ws_output_destroy(struct ws_output *output)
 {
 
-	if (output->ws_surface != NULL)
-		ws_surface_destroy(output->ws_surface);
+	wl_list_remove(&output->link);
+
+	ws_output_unmap(output);
+	ws_workspace_output_remove(output->app, output->wl_output);
 
 	if (output->wl_output != NULL)
-		wl_output_destroy(output->wl_output);
+		wl_output_release(output->wl_output);
 
+	free(output->name);
 	free(output);
 }
 
+static void
+output_geometry(void *data, struct wl_output *wl_output, int32_t x,
+    int32_t y, int32_t physical_width, int32_t physical_height,
+    int32_t subpixel, const char *make, const char *model, int32_t transform)
+{
+
+}
+
+static void
+output_mode(void *data, struct wl_output *wl_output, uint32_t flags,
+    int32_t width, int32_t height, int32_t refresh)
+{
+
+}
+
+static void
+output_done(void *data, struct wl_output *wl_output)
+{
+	struct ws_output *output;
+
+	output = data;
+
+	ws_rescale(output);
+}
+
+static void
+output_scale(void *data, struct wl_output *wl_output, int32_t factor)
+{
+	struct ws_output *output;
+
+	output = data;
+	output->scale = factor;
+}
+
+static void
+output_name(void *data, struct wl_output *wl_output, const char *name)
+{
+	struct ws_output *output;
+
+	output = data;
+
+	free(output->name);
+	output->name = strdup(name);
+}
+
+static void
+output_description(void *data, struct wl_output *wl_output,
+    const char *description)
+{
+
+}
+
+const static struct wl_output_listener wl_output_listener = {
+	.geometry = output_geometry,
+	.mode = output_mode,
+	.done = output_done,
+	.scale = output_scale,
+	.name = output_name,
+	.description = output_description,
+};
+
 void
 handle_global(void *data, struct wl_registry *registry, uint32_t name,
     const char *interface, uint32_t version)
@@ -139,7 +451,21 @@ handle_global(void *data, struct wl_registry *registry, uint32_t name,
 		    &wl_shm_interface, 1);
 	else if (strcmp(interface, wl_compositor_interface.name) == 0)
 		app->wl_compositor = wl_registry_bind(registry, name,
-		    &wl_compositor_interface, 1);
+		    &wl_compositor_interface, 4);
+	else if (strcmp(interface, wl_subcompositor_interface.name) == 0)
+		app->wl_subcompositor = wl_registry_bind(registry, name,
+		    &wl_subcompositor_interface, 1);
+	else if (strcmp(interface, wp_viewporter_interface.name) == 0)
+		app->viewporter = wl_registry_bind(registry, name,
+		    &wp_viewporter_interface, 1);
+	else if (strcmp(interface,
+	    wp_single_pixel_buffer_manager_v1_interface.name) == 0)
+		app->single_pixel = wl_registry_bind(registry, name,
+		    &wp_single_pixel_buffer_manager_v1_interface, 1);
+	else if (strcmp(interface,
+	    wp_fractional_scale_manager_v1_interface.name) == 0)
+		app->fractional_scale = wl_registry_bind(registry, name,
+		    &wp_fractional_scale_manager_v1_interface, 1);
 	else if (strcmp(interface, wl_output_interface.name) == 0) {
 
 		if (version < 4) {
@@ -147,89 +473,191 @@ handle_global(void *data, struct wl_registry *registry, uint32_t name,
 			return;
 		}
 
-		if (app->output != NULL) {
-			printf("No support for multiple outputs\n");
+		output = calloc(1, sizeof(struct ws_output));
+		if (output == NULL) {
+			printf("calloc failed");
 			return;
 		}
 
-		output = calloc(1, sizeof(struct ws_output));
-		app->output = output;
+		output->app = app;
+		output->global = name;
+		output->scale = 1;
+		wl_list_insert(app->outputs.prev, &output->link);
 		output->wl_output = wl_registry_bind(registry, name,
-		    &wl_output_interface, version);
-		output->ws_surface = ws_surface_create(app,
-		    output->wl_output);
-		wl_surface_commit(output->ws_surface->wl_surface);
+		    &wl_output_interface, 4);
+		wl_output_add_listener(output->wl_output, &wl_output_listener,
+		    output);
+		output->ws_surface = ws_surface_create(app, output);
+		if (output->ws_surface != NULL)
+			wl_surface_commit(output->ws_surface->wl_surface);
 
 	} else if (strcmp(interface, zwlr_layer_shell_v1_interface.name) == 0)
 		app->wlr_layer_shell = wl_registry_bind(registry, name,
 		    &zwlr_layer_shell_v1_interface, 1);
+	else if (strcmp(interface,
+	    ext_workspace_manager_v1_interface.name) == 0) {
+		app->workspace_manager = wl_registry_bind(registry, name,
+		    &ext_workspace_manager_v1_interface, 1);
+		ws_workspace_init(app);
+	}
 }
 
 void
 handle_global_remove(void *data, struct wl_registry *registry, uint32_t name)
 {
+	struct ws_output *output, *tmp;
+	struct ws *app;
 
-	/* No support. */
+	app = data;
+
+	wl_list_for_each_safe(output, tmp, &app->outputs, link)
+		if (output->global == name) {
+			ws_output_destroy(output);
+			break;
+		}
 }
 
+static void
+frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct ws_output *output;
+	struct ws *app;
+
+	output = data;
+
+	wl_callback_destroy(callback);
+	output->frame_cb = NULL;
+
+	app = output->app;
+
+	if (output->dirty)
+		ws_render_kick(app);
+}
+
+static const struct wl_callback_listener frame_listener = {
+	.done = frame_done,
+};
+
+/*
+ * Note that the state changed.  Each output is rendered right away if
+ * the compositor is not still busy with its last frame, otherwise its
+ * frame callback will, so bursts of updates end up in a single paint.
+ */
 void
-ws_flush(struct ws *app)
+ws_schedule(struct ws *app)
 {
 	struct ws_output *output;
 
-	output = app->output;
+	wl_list_for_each(output, &app->outputs, link)
+		output->dirty = true;
 
-	wl_surface_attach(output->ws_surface->wl_surface,
-	    app->wl_buffer, 0, 0);
-	wl_surface_damage(output->ws_surface->wl_surface, 0, 0,
-	    INT32_MAX, INT32_MAX);
-	wl_surface_commit(output->ws_surface->wl_surface);
+	ws_render_kick(app);
+}
 
-	if (wl_display_roundtrip(app->wl_display) < 1)
-		printf("wl_display_roundtrip failed");
+/* Send a panel's new pixels, applied with the next commit of the bar. */
+static bool
+ws_panel_flush(struct ws_panel *panel)
+{
+	struct ws_buffer *buf;
+	pixman_box32_t *rects;
+	int nrects;
+	int i;
+
+	if (panel->image == NULL ||
+	    !pixman_region32_not_empty(&panel->image->damage))
+		return (false);
+
+	rects = pixman_region32_rectangles(&panel->image->damage, &nrects);
+	for (i = 0; i < nrects; i++)
+		wl_surface_damage_buffer(panel->wl_surface, rects[i].x1,
+		    rects[i].y1, rects[i].x2 - rects[i].x1,
+		    rects[i].y2 - rects[i].y1);
+
+	buf = ws_image_end(panel->image);
+	if (buf == NULL)
+		return (false);
+
+	wl_surface_attach(panel->wl_surface, buf->wl_buffer, 0, 0);
+	wl_surface_commit(panel->wl_surface);
+
+	return (true);
 }
 
+void
+ws_flush(struct ws_output *output)
+{
+	struct ws_surface *surf;
+	bool commit;
+	int i;
+
+	surf = output->ws_surface;
+
+	/* Panels are synchronized subsurfaces: the bar commit shows them. */
+	commit = surf->commit;
+	commit |= ws_panel_flush(&surf->strip);
+	commit |= ws_panel_flush(&surf->clock);
+	commit |= ws_panel_flush(&surf->cursor);
+	for (i = 0; i < surf->nstatus; i++)
+		commit |= ws_panel_flush(&surf->status[i]);
+
+	/* Nothing changed on screen: keep the back buffers for next time. */
+	if (!commit)
+		return;
+
+	/* Pace the next render on this frame being shown. */
+	if (output->frame_cb == NULL) {
+		output->frame_cb = wl_surface_frame(surf->wl_surface);
+		wl_callback_add_listener(output->frame_cb, &frame_listener,
+		    output);
+	}
+
+	wl_surface_commit(surf->wl_surface);
+	surf->commit = false;
+
+	if (wl_display_flush(output->app->wl_display) < 0)
+		printf("wl_display_flush failed");
+}
+
+/*
+ * The clock only shows minutes: sleep until the next minute boundary
+ * instead of polling.  The timer is absolute wall clock time and gets
+ * cancelled if the clock is set, so a jump redraws right away.
+ */
 static void
-timer_arm(int secs)
+timer_arm(void)
 {
-	struct itimerspec spec = {
-		.it_interval = {0},
-		.it_value = {
-			.tv_sec = secs,
-			.tv_nsec = 0
-		}
-	};
-	if (timerfd_settime(timer_fd, 0, &spec, NULL))
+	struct itimerspec spec;
+	struct timespec now;
+	int flags;
+
+	if (clock_gettime(CLOCK_REALTIME, &now) != 0) {
+		fprintf(stderr, "clock_gettime failed: %s\n", strerror(errno));
+		return;
+	}
+
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = now.tv_sec - now.tv_sec % 60 + 60;
+
+	flags = TFD_TIMER_ABSTIME;
+#ifdef TFD_TIMER_CANCEL_ON_SET
+	flags |= TFD_TIMER_CANCEL_ON_SET;
+#endif
+
+	if (timerfd_settime(timer_fd, flags, &spec, NULL))
 		fprintf(stderr, "Failed to arm timer: %s\n", strerror(errno));
 }
 
+#define	WS_MAX_EVENTS	8
+
 int
 ws_main_loop(struct ws *app)
 {
-	struct sockaddr_un addr;
-	struct sockaddr_un from;
+	struct epoll_event events[WS_MAX_EVENTS];
 	uint64_t expirations;
-	socklen_t fromlen;
-	struct epoll_event caught;
 	int display_fd;
-	char buf[128];
-	int len;
 	int fd;
 	int n;
-
-	fromlen = sizeof(struct sockaddr_un);
-
-	if ((fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0)
-		perror("socket");
-
-	memset(buf, 0, 128);
-	memset(&addr, 0, sizeof(addr));
-	addr.sun_family = AF_UNIX;
-	strcpy(addr.sun_path, SERVER_SOCK_FILE);
-	unlink(SERVER_SOCK_FILE);
-
-	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
-		perror("bind");
+	int i;
 
 	int epoll = epoll_create1(EPOLL_CLOEXEC);
 	if (epoll < 0) {
@@ -252,7 +680,7 @@ ws_main_loop(struct ws *app)
 	wl_display_roundtrip(app->wl_display);
 
 	/* Timer */
-	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	timer_fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
 	if (timer_fd < 0) {
 		fprintf(stderr, "Failed to start timer\n");
 		return EXIT_FAILURE;
@@ -268,43 +696,81 @@ ws_main_loop(struct ws *app)
 		return EXIT_FAILURE;
 	}
 
-	timer_arm(1);
-
-	/* fd */
-	struct epoll_event epoll_net = {
+	/* Render thread */
+	struct epoll_event epoll_render = {
 		.events = EPOLLIN,
-		.data = { .fd = fd },
+		.data = { .fd = render_fd },
 	};
 
-	if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &epoll_net)) {
-		fprintf(stderr, "Failed to epoll net\n");
+	if (epoll_ctl(epoll, EPOLL_CTL_ADD, render_fd, &epoll_render)) {
+		fprintf(stderr, "Failed to epoll render thread\n");
 		return EXIT_FAILURE;
 	}
 
-	while (epoll_wait(epoll, &caught, 1, -1)) {
-		if (caught.data.fd == display_fd) {
-			if (wl_display_dispatch(app->wl_display) == -1)
-				break;
+	/* Status modules */
+	if (status_fd >= 0) {
+		struct epoll_event epoll_status = {
+			.events = EPOLLIN,
+			.data = { .fd = status_fd },
+		};
+
+		if (epoll_ctl(epoll, EPOLL_CTL_ADD, status_fd,
+		    &epoll_status)) {
+			fprintf(stderr, "Failed to epoll status timer\n");
+			return EXIT_FAILURE;
 		}
-		if (caught.data.fd == timer_fd) {
-			n = read(timer_fd, &expirations, sizeof(expirations));
-			timer_arm(1);
-			ws_draw_time(app);
-		}
-		if (caught.data.fd == fd) {
-			len = recvfrom(fd, buf, 8192, 0,
-			    (struct sockaddr *)&from, &fromlen);
-			/* printf("recvfrom: %s, len %d\n", buf, len); */
-			if (buf[0] == 'W')
-				draw_numbers(app, &buf[1]);
-#if 0
-			else if (buf[0] == 'C')
-				draw_cursor_xy(app, &buf[1]);
-#endif
+	}
+
+	/* Cursor overlay */
+	if (cursor_fd >= 0) {
+		struct epoll_event epoll_cursor = {
+			.events = EPOLLIN,
+			.data = { .fd = cursor_fd },
+		};
+
+		if (epoll_ctl(epoll, EPOLL_CTL_ADD, cursor_fd,
+		    &epoll_cursor)) {
+			fprintf(stderr, "Failed to epoll cursor watcher\n");
+			return EXIT_FAILURE;
 		}
+		ws_cursor_sample(app);
 	}
 
-	close(fd);
+	timer_arm();
+
+	ws_schedule(app);
+
+	for (;;) {
+		n = epoll_wait(epoll, events, WS_MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "epoll_wait failed: %s\n",
+			    strerror(errno));
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			fd = events[i].data.fd;
+			if (fd == display_fd) {
+				if (wl_display_dispatch(app->wl_display) == -1)
+					return (0);
+			} else if (fd == timer_fd) {
+				/* ECANCELED: the clock was set, re-arm too. */
+				if (read(timer_fd, &expirations,
+				    sizeof(expirations)) < 0 &&
+				    errno == EAGAIN)
+					continue;
+				timer_arm();
+				ws_schedule(app);
+			} else if (fd == status_fd)
+				ws_status_expire(app);
+			else if (fd == render_fd)
+				ws_render_done(app);
+			else if (fd == cursor_fd)
+				ws_cursor_moved(app);
+		}
+	}
 
 	return (0);
 }
@@ -312,14 +778,6 @@ ws_main_loop(struct ws *app)
 static int
 ws_startup_app(struct ws *app)
 {
-	struct ws_output *output;
-	struct wl_shm_pool *pool;
-	struct ws_image *image;
-
-	image = ws_image_create(app->name, app->width, app->height);
-
-	app->image = image;
-
 	const static struct wl_registry_listener wl_registry_listener = {
 		.global = handle_global,
 		.global_remove = handle_global_remove,
@@ -364,20 +822,15 @@ ws_startup_app(struct ws *app)
 		return (-1);
 	}
 
-	pool = wl_shm_create_pool(app->wl_shm, app->image->shmid,
-	    app->image->size_in_bytes);
-	if (pool == NULL) {
-		printf("wl_shm_create_pool failed");
+	if (app->wl_subcompositor == NULL || app->viewporter == NULL ||
+	    app->single_pixel == NULL) {
+		printf("No subcompositor, viewporter or single pixel buffer "
+		    "available\n");
 		return (-1);
 	}
 
-	app->wl_buffer = wl_shm_pool_create_buffer(pool, 0, app->image->width,
-	    app->image->height, app->image->stride, WL_SHM_FORMAT_ARGB8888);
-	wl_shm_pool_destroy(pool);
-	if (app->wl_buffer == NULL) {
-		printf("wl_shm_pool_create_buffer failed");
-		return (-1);
-	}
+	if (app->workspace_manager == NULL)
+		printf("No ext_workspace_manager_v1 available\n");
 
 	return (0);
 }
@@ -385,15 +838,27 @@ ws_startup_app(struct ws *app)
 static int
 ws_destroy_app(struct ws *app)
 {
+	struct ws_output *output, *tmp;
 
+	wl_list_for_each_safe(output, tmp, &app->outputs, link)
+		ws_output_destroy(output);
+	ws_render_fini();
 	zwlr_layer_shell_v1_destroy(app->wlr_layer_shell);
-	wl_buffer_destroy(app->wl_buffer);
+	if (app->fractional_scale != NULL)
+		wp_fractional_scale_manager_v1_destroy(app->fractional_scale);
+	wp_single_pixel_buffer_manager_v1_destroy(app->single_pixel);
+	wp_viewporter_destroy(app->viewporter);
+	wl_subcompositor_destroy(app->wl_subcompositor);
 	wl_compositor_destroy(app->wl_compositor);
 	wl_shm_destroy(app->wl_shm);
 	wl_registry_destroy(app->wl_registry);
 	wl_display_roundtrip(app->wl_display);
 	wl_display_disconnect(app->wl_display);
-	ws_image_destroy(app->image);
+	ws_cursor_fini();
+	ws_status_fini();
+	ws_atlas_fini();
+	ws_font_fini();
+	fcft_fini();
 	free(app);
 
 	return (0);
@@ -403,18 +868,50 @@ int
 main(int argc, char **argv)
 {
 	struct ws *app;
+	int ch;
 
 	app = calloc(1, sizeof(struct ws));
+	wl_list_init(&app->outputs);
+	wl_list_init(&app->groups);
+	wl_list_init(&app->workspaces);
 	app->name = "app";
 	app->margin_top = 0;
 	app->margin_right = 0;
 	app->margin_bottom = 0;
 	app->margin_left = 0;
-	app->width = MAX_WIDTH;
-	app->height = MAX_HEIGHT;
-	app->anchor = ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT;
+	app->anchor = ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT |
+	    ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP |
+	    ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM;
+
+	while ((ch = getopt(argc, argv, "c")) != -1) {
+		switch (ch) {
+		case 'c':
+			app->cursor = true;
+			break;
+		default:
+			fprintf(stderr, "usage: ws [-c]\n");
+			return (1);
+		}
+	}
+
+	/* The overlay needs the cursor slot of stage's state page. */
+	if (app->cursor) {
+		cursor_fd = ws_cursor_init();
+		if (cursor_fd < 0)
+			app->cursor = false;
+	}
 
 	fcft_init(FCFT_LOG_COLORIZE_AUTO, false, FCFT_LOG_CLASS_DEBUG);
+	ws_atlas_init();
+
+	/* Only as wide as the glyphs, as tall as the output (logical). */
+	app->width = ws_image_content_width();
+	app->height = 0;
+
+	status_fd = ws_status_init();
+	render_fd = ws_render_init();
+	if (render_fd < 0)
+		return (1);
 
 	ws_startup_app(app);
 	ws_main_loop(app);
@@ -0,0 +1,275 @@
+/*-
+ * Copyright (c) 2026 Ruslan Bukin <br@bsdpad.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Render thread.
+ *
+ * The event thread owns every Wayland object and all the state the bar
+ * shows; the render thread only turns text into pixels.  A render job
+ * goes like this:
+ *
+ *  - the event thread fills the back snapshot with the text of every
+ *    bar that is dirty and not waiting on a frame callback, publishes
+ *    it by flipping snap_front and pokes request_fd;
+ *  - the render thread draws the published snapshot into the panels'
+ *    back buffers and pokes done_fd;
+ *  - the event thread commits the drawn buffers and, if anything
+ *    changed meanwhile, starts the next job.
+ *
+ * Only one job is in flight, so the snapshot being drawn is never the
+ * one being filled.  Anything that frees or replaces panel buffers
+ * calls ws_render_sync() first.
+ */
+
+#include <sys/eventfd.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pixman.h>
+
+#include "wlr-layer-shell-unstable-v1-client-protocol.h"
+#include "image.h"
+
+#define	SNAP_OUTPUTS		8
+
+struct ws_snap_output {
+	struct ws_output *output;
+	char strip[WS_STRIP_LEN];
+	char clock[TEXT_MAX];
+	char cursor[TEXT_MAX];
+	char status[WS_STATUS_MAX][WS_STATUS_LEN + 1];
+	int nstatus;
+};
+
+struct ws_snap {
+	int noutputs;
+	struct ws_snap_output outputs[SNAP_OUTPUTS];
+};
+
+static struct ws_snap snaps[2];
+static unsigned int snap_front;		/* Published to the render thread. */
+static bool stopping;
+
+static pthread_t render_thread;
+static int request_fd = -1;
+static int done_fd = -1;
+static bool in_flight;			/* Event thread only. */
+
+static void
+render_poke(int fd)
+{
+	uint64_t val;
+
+	val = 1;
+	if (write(fd, &val, sizeof(val)) < 0)
+		printf("render: eventfd write failed: %s\n", strerror(errno));
+}
+
+static void *
+render_main(void *arg)
+{
+	struct ws_snap_output *so;
+	struct ws_surface *surf;
+	struct ws_snap *snap;
+	uint64_t val;
+	int i, j;
+
+	for (;;) {
+		if (read(request_fd, &val, sizeof(val)) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+			break;
+
+		snap = &snaps[__atomic_load_n(&snap_front, __ATOMIC_ACQUIRE)];
+
+		for (i = 0; i < snap->noutputs; i++) {
+			so = &snap->outputs[i];
+			surf = so->output->ws_surface;
+
+			draw_numbers(&surf->strip, so->strip);
+			for (j = 0; j < so->nstatus; j++)
+				ws_draw_status(&surf->status[j], so->status[j]);
+			ws_draw_time(&surf->clock, so->clock);
+			if (so->cursor[0] != '\0')
+				draw_cursor_xy(&surf->cursor, so->cursor);
+		}
+
+		render_poke(done_fd);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Snapshot the bars that can take a new frame and hand them to the
+ * render thread.  Does nothing while a job is in flight: its completion
+ * comes back here.
+ */
+void
+ws_render_kick(struct ws *app)
+{
+	struct ws_snap_output *so;
+	struct ws_output *output;
+	struct ws_surface *surf;
+	struct ws_snap *snap;
+	unsigned int back;
+	struct tm tm;
+	time_t now;
+	int i;
+
+	if (in_flight)
+		return;
+
+	back = snap_front ^ 1;
+	snap = &snaps[back];
+	snap->noutputs = 0;
+
+	now = time(NULL);
+	localtime_r(&now, &tm);
+
+	wl_list_for_each(output, &app->outputs, link) {
+		surf = output->ws_surface;
+		if (!output->dirty || output->frame_cb != NULL ||
+		    surf == NULL || surf->height == 0)
+			continue;
+		if (snap->noutputs == SNAP_OUTPUTS)
+			break;
+
+		output->dirty = false;
+
+		so = &snap->outputs[snap->noutputs++];
+		so->output = output;
+		ws_workspace_text(output, so->strip, sizeof(so->strip));
+		strftime(so->clock, sizeof(so->clock), "%H:%M", &tm);
+		so->cursor[0] = '\0';
+		if (app->cursor)
+			snprintf(so->cursor, sizeof(so->cursor), "%d,%d",
+			    app->cursor_x, app->cursor_y);
+		so->nstatus = surf->nstatus;
+		for (i = 0; i < surf->nstatus; i++)
+			snprintf(so->status[i], sizeof(so->status[i]), "%s",
+			    ws_status_text(i));
+	}
+
+	if (snap->noutputs == 0)
+		return;
+
+	__atomic_store_n(&snap_front, back, __ATOMIC_RELEASE);
+	in_flight = true;
+	render_poke(request_fd);
+}
+
+/* The job is drawn: commit what it drew. */
+static void
+render_finish(void)
+{
+	struct ws_snap *snap;
+	int i;
+
+	in_flight = false;
+
+	snap = &snaps[snap_front];
+	for (i = 0; i < snap->noutputs; i++)
+		ws_flush(snap->outputs[i].output);
+}
+
+void
+ws_render_done(struct ws *app)
+{
+	uint64_t val;
+
+	if (read(done_fd, &val, sizeof(val)) < 0)
+		return;
+
+	render_finish();
+	ws_render_kick(app);
+}
+
+/* Wait for the job in flight, if any, before touching panel buffers. */
+void
+ws_render_sync(void)
+{
+	struct pollfd pfd;
+	uint64_t val;
+
+	if (!in_flight)
+		return;
+
+	pfd.fd = done_fd;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, -1) < 0 && errno == EINTR)
+		;
+
+	if (read(done_fd, &val, sizeof(val)) < 0)
+		return;
+
+	render_finish();
+}
+
+int
+ws_render_init(void)
+{
+
+	request_fd = eventfd(0, EFD_CLOEXEC);
+	done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (request_fd < 0 || done_fd < 0) {
+		printf("eventfd failed: %s\n", strerror(errno));
+		return (-1);
+	}
+
+	if (pthread_create(&render_thread, NULL, render_main, NULL) != 0) {
+		printf("pthread_create failed\n");
+		return (-1);
+	}
+
+	return (done_fd);
+}
+
+void
+ws_render_fini(void)
+{
+
+	ws_render_sync();
+
+	__atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+	render_poke(request_fd);
+	pthread_join(render_thread, NULL);
+
+	close(request_fd);
+	close(done_fd);
+	request_fd = done_fd = -1;
+}
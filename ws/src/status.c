@@ -0,0 +1,400 @@
+/*-
+ * Copyright (c) 2026 Ruslan Bukin <br@bsdpad.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Status modules: small readouts stacked above the clock.
+ *
+ * Each module keeps its source file open and re-reads it with pread()
+ * at offset 0, which makes procfs and sysfs regenerate the contents.
+ * Modules sit on a timer wheel with one second slots, and a single
+ * timerfd is armed for the next occupied slot only.
+ */
+
+#include <sys/timerfd.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pixman.h>
+
+#include "wlr-layer-shell-unstable-v1-client-protocol.h"
+#include "image.h"
+
+#define	STATUS_BUF_LEN		4096
+#define	WHEEL_SIZE		64	/* Slots, longest interval is less. */
+
+#define	POWER_SUPPLY		"/sys/class/power_supply"
+
+struct ws_status {
+	const char *path;
+	int interval;			/* Seconds. */
+	int (*open)(struct ws_status *st);
+	void (*sample)(struct ws_status *st, const char *data);
+	int fd;
+	uint64_t prev_busy;
+	uint64_t prev_total;
+	char text[WS_STATUS_LEN + 1];
+	struct ws_status *next;		/* Wheel slot chain. */
+};
+
+static void status_cpu(struct ws_status *st, const char *data);
+static void status_mem(struct ws_status *st, const char *data);
+static void status_load(struct ws_status *st, const char *data);
+static void status_battery(struct ws_status *st, const char *data);
+static int status_battery_open(struct ws_status *st);
+
+static struct ws_status modules[] = {
+	{ "/proc/stat", 2, NULL, status_cpu },
+	{ "/proc/meminfo", 5, NULL, status_mem },
+	{ "/proc/loadavg", 5, NULL, status_load },
+	{ NULL, 30, status_battery_open, status_battery },
+};
+
+#define	NMODULES	(sizeof(modules) / sizeof(modules[0]))
+
+static struct ws_status *active[WS_STATUS_MAX];
+static int nactive;
+
+static struct ws_status *wheel[WHEEL_SIZE];
+static uint64_t wheel_tick;
+static int wheel_fd = -1;
+
+/* Parse the next unsigned number in *p, skipping anything before it. */
+static uint64_t
+status_number(const char **p)
+{
+	const char *s;
+	uint64_t val;
+
+	s = *p;
+	while (*s != '\0' && (*s < '0' || *s > '9'))
+		s++;
+
+	val = 0;
+	while (*s >= '0' && *s <= '9')
+		val = val * 10 + (*s++ - '0');
+
+	*p = s;
+
+	return (val);
+}
+
+static void
+status_percent(struct ws_status *st, char c, uint64_t part, uint64_t total)
+{
+	uint64_t pct;
+
+	pct = (total != 0) ? (part * 100 + total / 2) / total : 0;
+	if (pct > 100)
+		pct = 100;
+
+	snprintf(st->text, sizeof(st->text), "%c%3u", c, (unsigned)pct);
+}
+
+/* cpu  user nice system idle iowait irq softirq steal */
+static void
+status_cpu(struct ws_status *st, const char *data)
+{
+	uint64_t busy, total, idle, val;
+	const char *p;
+	int i;
+
+	if (strncmp(data, "cpu ", 4) != 0)
+		return;
+
+	p = data + 4;
+	busy = total = idle = 0;
+	for (i = 0; i < 8; i++) {
+		val = status_number(&p);
+		total += val;
+		if (i == 3 || i == 4)
+			idle += val;
+	}
+	busy = total - idle;
+
+	if (st->prev_total != 0 && total > st->prev_total)
+		status_percent(st, 'c', busy - st->prev_busy,
+		    total - st->prev_total);
+
+	st->prev_busy = busy;
+	st->prev_total = total;
+}
+
+static void
+status_mem(struct ws_status *st, const char *data)
+{
+	uint64_t total, avail;
+	const char *p;
+
+	p = strstr(data, "MemTotal:");
+	if (p == NULL)
+		return;
+	total = status_number(&p);
+
+	p = strstr(data, "MemAvailable:");
+	if (p == NULL)
+		return;
+	avail = status_number(&p);
+
+	if (avail > total)
+		avail = total;
+
+	status_percent(st, 'm', total - avail, total);
+}
+
+/* The 1 minute average, as the kernel formats it. */
+static void
+status_load(struct ws_status *st, const char *data)
+{
+	int i;
+
+	st->text[0] = 'l';
+	for (i = 0; i < WS_STATUS_LEN - 1 && data[i] != ' ' &&
+	    data[i] != '\0'; i++)
+		st->text[i + 1] = data[i];
+	st->text[i + 1] = '\0';
+}
+
+static void
+status_battery(struct ws_status *st, const char *data)
+{
+	const char *p;
+
+	p = data;
+	status_percent(st, 'b', status_number(&p), 100);
+}
+
+/* Find the first supply of type Battery and keep its capacity open. */
+static int
+status_battery_open(struct ws_status *st)
+{
+	char path[PATH_MAX];
+	char type[16];
+	struct dirent *de;
+	ssize_t n;
+	DIR *dir;
+	int fd;
+
+	dir = opendir(POWER_SUPPLY);
+	if (dir == NULL)
+		return (-1);
+
+	fd = -1;
+	while (fd < 0 && (de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s/type", POWER_SUPPLY,
+		    de->d_name);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		n = pread(fd, type, sizeof(type) - 1, 0);
+		close(fd);
+		fd = -1;
+		if (n < 7 || strncmp(type, "Battery", 7) != 0)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s/capacity", POWER_SUPPLY,
+		    de->d_name);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+	}
+
+	closedir(dir);
+
+	return (fd);
+}
+
+/* Returns true if the text changed. */
+static bool
+status_sample(struct ws_status *st)
+{
+	char data[STATUS_BUF_LEN];
+	char old[WS_STATUS_LEN + 1];
+	ssize_t n;
+
+	n = pread(st->fd, data, sizeof(data) - 1, 0);
+	if (n <= 0)
+		return (false);
+	data[n] = '\0';
+
+	memcpy(old, st->text, sizeof(old));
+	st->sample(st, data);
+
+	return (strcmp(old, st->text) != 0);
+}
+
+static uint64_t
+status_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec);
+}
+
+static void
+wheel_insert(struct ws_status *st, uint64_t tick)
+{
+	struct ws_status **slot;
+
+	slot = &wheel[tick % WHEEL_SIZE];
+	st->next = *slot;
+	*slot = st;
+}
+
+/* Arm the timer for the next occupied slot. */
+static void
+wheel_arm(void)
+{
+	struct itimerspec spec;
+	int i;
+
+	for (i = 0; i < WHEEL_SIZE; i++)
+		if (wheel[(wheel_tick + i) % WHEEL_SIZE] != NULL)
+			break;
+	if (i == WHEEL_SIZE)
+		return;
+
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = wheel_tick + i;
+
+	if (timerfd_settime(wheel_fd, TFD_TIMER_ABSTIME, &spec, NULL))
+		fprintf(stderr, "Failed to arm status timer: %s\n",
+		    strerror(errno));
+}
+
+/*
+ * Run every slot that came due, reschedule its modules and arm the
+ * timer again.  Redraws only if a readout actually changed.
+ */
+void
+ws_status_expire(struct ws *app)
+{
+	struct ws_status *st, *next;
+	uint64_t expirations;
+	uint64_t now;
+	bool changed;
+	int slot;
+
+	if (read(wheel_fd, &expirations, sizeof(expirations)) < 0 &&
+	    errno == EAGAIN)
+		return;
+
+	now = status_now();
+	if (now >= wheel_tick && now - wheel_tick >= WHEEL_SIZE)
+		wheel_tick = now - WHEEL_SIZE + 1;
+
+	changed = false;
+	for (; wheel_tick <= now; wheel_tick++) {
+		slot = wheel_tick % WHEEL_SIZE;
+		st = wheel[slot];
+		wheel[slot] = NULL;
+		for (; st != NULL; st = next) {
+			next = st->next;
+			changed |= status_sample(st);
+			wheel_insert(st, now + st->interval);
+		}
+	}
+
+	wheel_arm();
+
+	if (changed)
+		ws_schedule(app);
+}
+
+int
+ws_status_init(void)
+{
+	struct ws_status *st;
+	uint64_t now;
+	size_t i;
+
+	wheel_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (wheel_fd < 0) {
+		fprintf(stderr, "Failed to start status timer\n");
+		return (-1);
+	}
+
+	now = status_now();
+	wheel_tick = now + 1;
+
+	/* Sources that are not there (no battery, no procfs) are skipped. */
+	for (i = 0; i < NMODULES && nactive < WS_STATUS_MAX; i++) {
+		st = &modules[i];
+		if (st->open != NULL)
+			st->fd = st->open(st);
+		else
+			st->fd = open(st->path, O_RDONLY | O_CLOEXEC);
+		if (st->fd < 0)
+			continue;
+
+		status_sample(st);
+		wheel_insert(st, now + st->interval);
+		active[nactive++] = st;
+	}
+
+	wheel_arm();
+
+	return (wheel_fd);
+}
+
+void
+ws_status_fini(void)
+{
+	int i;
+
+	for (i = 0; i < nactive; i++)
+		close(active[i]->fd);
+	nactive = 0;
+
+	if (wheel_fd >= 0)
+		close(wheel_fd);
+	wheel_fd = -1;
+}
+
+int
+ws_status_count(void)
+{
+
+	return (nactive);
+}
+
+const char *
+ws_status_text(int i)
+{
+
+	return (active[i]->text);
+}
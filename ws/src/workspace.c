@@ -0,0 +1,336 @@
+/*-
+ * Copyright (c) 2026 Ruslan Bukin <br@bsdpad.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pixman.h>
+
+#include "wlr-layer-shell-unstable-v1-client-protocol.h"
+#include "ext-workspace-v1-client-protocol.h"
+#include "image.h"
+
+/*
+ * Build the strip for an output from its workspace group.  The marker
+ * format is the one draw_numbers() has always understood: '!' current
+ * workspace, '?' the one that was current before it.
+ */
+static void
+ws_workspace_build(struct ws *app, struct ws_group *group, char *buf,
+    size_t len)
+{
+	struct ws_workspace *ws;
+	char *cur;
+
+	cur = buf;
+
+	wl_list_for_each(ws, &app->workspaces, link) {
+		if (ws->group != group || ws->name == NULL)
+			continue;
+		if (cur + 3 > buf + len)
+			break;
+
+		if (ws->state & EXT_WORKSPACE_HANDLE_V1_STATE_ACTIVE) {
+			*cur++ = '!';
+			*cur++ = ws->name[0];
+		} else if ((ws->state &
+		    EXT_WORKSPACE_HANDLE_V1_STATE_HIDDEN) == 0) {
+			if (ws == group->previous)
+				*cur++ = '?';
+			*cur++ = ws->name[0];
+		}
+	}
+
+	*cur = '\0';
+}
+
+static void
+workspace_id(void *data, struct ext_workspace_handle_v1 *handle,
+    const char *id)
+{
+
+}
+
+static void
+workspace_name(void *data, struct ext_workspace_handle_v1 *handle,
+    const char *name)
+{
+	struct ws_workspace *ws;
+
+	ws = data;
+
+	free(ws->name);
+	ws->name = strdup(name);
+}
+
+static void
+workspace_coordinates(void *data, struct ext_workspace_handle_v1 *handle,
+    struct wl_array *coordinates)
+{
+
+}
+
+static void
+workspace_state(void *data, struct ext_workspace_handle_v1 *handle,
+    uint32_t state)
+{
+	struct ws_workspace *ws;
+
+	ws = data;
+	ws->state = state;
+}
+
+static void
+workspace_capabilities(void *data, struct ext_workspace_handle_v1 *handle,
+    uint32_t capabilities)
+{
+
+}
+
+static void
+workspace_removed(void *data, struct ext_workspace_handle_v1 *handle)
+{
+	struct ws_workspace *ws;
+
+	ws = data;
+
+	if (ws->group != NULL && ws->group->previous == ws)
+		ws->group->previous = NULL;
+	if (ws->group != NULL && ws->group->active == ws)
+		ws->group->active = NULL;
+
+	wl_list_remove(&ws->link);
+	ext_workspace_handle_v1_destroy(ws->handle);
+	free(ws->name);
+	free(ws);
+}
+
+static const struct ext_workspace_handle_v1_listener workspace_listener = {
+	.id = workspace_id,
+	.name = workspace_name,
+	.coordinates = workspace_coordinates,
+	.state = workspace_state,
+	.capabilities = workspace_capabilities,
+	.removed = workspace_removed,
+};
+
+static void
+group_capabilities(void *data, struct ext_workspace_group_handle_v1 *handle,
+    uint32_t capabilities)
+{
+
+}
+
+static void
+group_output_enter(void *data, struct ext_workspace_group_handle_v1 *handle,
+    struct wl_output *output)
+{
+	struct ws_group *group;
+
+	group = data;
+	group->wl_output = output;
+}
+
+static void
+group_output_leave(void *data, struct ext_workspace_group_handle_v1 *handle,
+    struct wl_output *output)
+{
+	struct ws_group *group;
+
+	group = data;
+	if (group->wl_output == output)
+		group->wl_output = NULL;
+}
+
+static void
+group_workspace_enter(void *data,
+    struct ext_workspace_group_handle_v1 *handle,
+    struct ext_workspace_handle_v1 *workspace)
+{
+	struct ws_workspace *ws;
+
+	ws = ext_workspace_handle_v1_get_user_data(workspace);
+	ws->group = data;
+}
+
+static void
+group_workspace_leave(void *data,
+    struct ext_workspace_group_handle_v1 *handle,
+    struct ext_workspace_handle_v1 *workspace)
+{
+	struct ws_workspace *ws;
+
+	ws = ext_workspace_handle_v1_get_user_data(workspace);
+	if (ws->group == data)
+		ws->group = NULL;
+}
+
+static void
+group_removed(void *data, struct ext_workspace_group_handle_v1 *handle)
+{
+	struct ws_group *group;
+	struct ws_workspace *ws;
+	struct ws *app;
+
+	group = data;
+	app = group->app;
+
+	wl_list_for_each(ws, &app->workspaces, link)
+		if (ws->group == group)
+			ws->group = NULL;
+
+	wl_list_remove(&group->link);
+	ext_workspace_group_handle_v1_destroy(group->handle);
+	free(group);
+}
+
+static const struct ext_workspace_group_handle_v1_listener group_listener = {
+	.capabilities = group_capabilities,
+	.output_enter = group_output_enter,
+	.output_leave = group_output_leave,
+	.workspace_enter = group_workspace_enter,
+	.workspace_leave = group_workspace_leave,
+	.removed = group_removed,
+};
+
+static void
+manager_workspace_group(void *data, struct ext_workspace_manager_v1 *manager,
+    struct ext_workspace_group_handle_v1 *handle)
+{
+	struct ws_group *group;
+	struct ws *app;
+
+	app = data;
+
+	group = calloc(1, sizeof(struct ws_group));
+	if (group == NULL)
+		return;
+
+	group->app = app;
+	group->handle = handle;
+	wl_list_insert(app->groups.prev, &group->link);
+	ext_workspace_group_handle_v1_add_listener(handle, &group_listener,
+	    group);
+}
+
+static void
+manager_workspace(void *data, struct ext_workspace_manager_v1 *manager,
+    struct ext_workspace_handle_v1 *handle)
+{
+	struct ws_workspace *ws;
+	struct ws *app;
+
+	app = data;
+
+	ws = calloc(1, sizeof(struct ws_workspace));
+	if (ws == NULL)
+		return;
+
+	ws->handle = handle;
+	wl_list_insert(app->workspaces.prev, &ws->link);
+	ext_workspace_handle_v1_add_listener(handle, &workspace_listener, ws);
+}
+
+static void
+manager_done(void *data, struct ext_workspace_manager_v1 *manager)
+{
+	struct ws_workspace *ws, *active;
+	struct ws_group *group;
+	struct ws *app;
+
+	app = data;
+
+	wl_list_for_each(group, &app->groups, link) {
+		active = NULL;
+		wl_list_for_each(ws, &app->workspaces, link)
+			if (ws->group == group &&
+			    (ws->state & EXT_WORKSPACE_HANDLE_V1_STATE_ACTIVE))
+				active = ws;
+
+		if (active != group->active) {
+			if (group->active != NULL)
+				group->previous = group->active;
+			group->active = active;
+		}
+	}
+
+	ws_schedule(app);
+}
+
+static void
+manager_finished(void *data, struct ext_workspace_manager_v1 *manager)
+{
+	struct ws *app;
+
+	app = data;
+
+	ext_workspace_manager_v1_destroy(app->workspace_manager);
+	app->workspace_manager = NULL;
+}
+
+static const struct ext_workspace_manager_v1_listener manager_listener = {
+	.workspace_group = manager_workspace_group,
+	.workspace = manager_workspace,
+	.done = manager_done,
+	.finished = manager_finished,
+};
+
+/* Each output shows the group the compositor put on it. */
+void
+ws_workspace_text(struct ws_output *output, char *buf, size_t len)
+{
+	struct ws_group *group;
+	struct ws *app;
+
+	app = output->app;
+	buf[0] = '\0';
+
+	wl_list_for_each(group, &app->groups, link)
+		if (group->wl_output == output->wl_output) {
+			ws_workspace_build(app, group, buf, len);
+			break;
+		}
+}
+
+/* The output is going away: forget groups still pointing at it. */
+void
+ws_workspace_output_remove(struct ws *app, struct wl_output *wl_output)
+{
+	struct ws_group *group;
+
+	wl_list_for_each(group, &app->groups, link)
+		if (group->wl_output == wl_output)
+			group->wl_output = NULL;
+}
+
+void
+ws_workspace_init(struct ws *app)
+{
+
+	ext_workspace_manager_v1_add_listener(app->workspace_manager,
+	    &manager_listener, app);
+}